@@ -5,14 +5,71 @@
 */
 #include "CharxPSM2.hpp"
 
+#include <algorithm>
+
+#include <everest/logging.hpp>
+
 namespace module {
 
 void CharxPSM2::init() {
+    PowerModuleBus::Config bus_config;
+    bus_config.device = config.device;
+    bus_config.broker.io_backend =
+        (config.can_io_backend == "io_uring") ? CanBroker::IoBackend::IO_URING : CanBroker::IoBackend::POLL;
+    bus_config.broker.timeouts.floor = std::chrono::milliseconds(static_cast<int>(config.can_timeout_floor_ms));
+    bus_config.broker.timeouts.ceiling = std::chrono::milliseconds(static_cast<int>(config.can_timeout_ceiling_ms));
+    if (bus_config.broker.timeouts.ceiling < bus_config.broker.timeouts.floor) {
+        EVLOG_error << "can_timeout_ceiling_ms is below can_timeout_floor_ms, the floor is used as ceiling";
+        bus_config.broker.timeouts.ceiling = bus_config.broker.timeouts.floor;
+    }
+    bus_config.broker.timeouts.safety_factor = config.can_timeout_rtt_factor;
+    bus_config.broker.hedged_retry = config.can_hedged_retry;
+    bus_config.broker.tx_ceiling_frames_per_s = config.can_tx_ceiling_frames_per_s;
+    bus_config.reactor_mode = config.reactor_mode;
+    bus_config.number_of_power_modules = config.number_of_power_modules;
+    bus_config.control_period = std::clamp(std::chrono::milliseconds(static_cast<int>(config.control_period_ms)),
+                                           CycleScheduler::MIN_PERIOD, CycleScheduler::MAX_PERIOD);
+    bus_config.setpoint_min_spacing = std::chrono::milliseconds(static_cast<int>(config.setpoint_min_spacing_ms));
+    bus_config.setpoint_keepalive = std::clamp(std::chrono::milliseconds(static_cast<int>(config.setpoint_keepalive_ms)),
+                                               CycleScheduler::MIN_PERIOD, CycleScheduler::MAX_PERIOD);
+    bus_config.low_priority_budget = config.control_low_priority_budget;
+    bus_config.telemetry_period = std::chrono::milliseconds(static_cast<int>(config.telemetry_period_ms));
+    bus_config.status_period = std::chrono::milliseconds(static_cast<int>(config.status_period_ms));
+    bus_config.module_telemetry_period = std::chrono::milliseconds(static_cast<int>(config.module_telemetry_period_ms));
+    bus_config.module_info_period = std::chrono::milliseconds(static_cast<int>(config.module_info_period_ms));
+    bus_config.bus_budget_frames_per_s = config.can_bus_budget_frames_per_s;
+    bus_config.module_staging = config.module_staging;
+    bus_config.staging.module_power = config.staging_module_power_W;
+    bus_config.staging.optimal_load = config.staging_optimal_load;
+    bus_config.staging.hysteresis = config.staging_hysteresis;
+    bus_config.staging.temperature_limit = config.staging_temperature_limit_C;
+    bus_config.staging.hold = std::chrono::milliseconds(static_cast<int>(config.staging_hold_ms));
+    bus_config.derating.start_temperature = config.derating_start_temperature_C;
+    bus_config.derating.end_temperature = config.derating_end_temperature_C;
+    bus_config.derating.min_factor = config.derating_min_factor;
+    bus_config.derating.republish_threshold = config.derating_republish_threshold;
+    bus_config.current_regulation = config.current_regulation;
+    bus_config.regulation.period = std::chrono::milliseconds(static_cast<int>(config.current_regulation_period_ms));
+    bus_config.regulation.kp = config.current_regulation_kp;
+    bus_config.regulation.ki = config.current_regulation_ki;
+    bus_config.regulation.max_trim = config.current_regulation_max_trim_A;
+    bus_config.regulation.tolerance = config.current_regulation_tolerance_A;
+    bus_config.debug_print_all_telemetry = config.debug_print_all_telemetry;
+
+    // one CAN broker for all connectors
+    bus = std::make_unique<PowerModuleBus>(
+        bus_config, [this](const std::string& topic, const std::string& payload) { mqtt.publish(topic, payload); });
+
     invoke_init(*p_main);
+    invoke_init(*p_connector_2);
 }
 
 void CharxPSM2::ready() {
     invoke_ready(*p_main);
+    invoke_ready(*p_connector_2);
+
+    // the command sequences of all connectors run as coroutines on this thread
+    bus->run();
 }
 
 } // namespace module
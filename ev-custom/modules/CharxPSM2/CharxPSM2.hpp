@@ -19,6 +19,7 @@
 
 // ev@4bf81b14-a215-475c-a1d3-0a484ae48918:v1
 // insert your custom include headers here
+#include "main/power_module_bus.hpp"
 // ev@4bf81b14-a215-475c-a1d3-0a484ae48918:v1
 
 namespace module {
@@ -31,6 +32,38 @@ struct Conf {
     double power_limit_W;
     double current_limit_A;
     double voltage_limit_V;
+    std::string can_io_backend;
+    bool reactor_mode;
+    double control_period_ms;
+    double setpoint_min_spacing_ms;
+    double setpoint_keepalive_ms;
+    double control_low_priority_budget;
+    double telemetry_period_ms;
+    double status_period_ms;
+    double module_telemetry_period_ms;
+    double module_info_period_ms;
+    double can_bus_budget_frames_per_s;
+    bool module_staging;
+    double staging_module_power_W;
+    double staging_optimal_load;
+    double staging_hysteresis;
+    double staging_temperature_limit_C;
+    double staging_hold_ms;
+    double derating_start_temperature_C;
+    double derating_end_temperature_C;
+    double derating_min_factor;
+    double derating_republish_threshold;
+    bool current_regulation;
+    double current_regulation_period_ms;
+    double current_regulation_kp;
+    double current_regulation_ki;
+    double current_regulation_max_trim_A;
+    double current_regulation_tolerance_A;
+    double can_tx_ceiling_frames_per_s;
+    double can_timeout_floor_ms;
+    double can_timeout_ceiling_ms;
+    double can_timeout_rtt_factor;
+    bool can_hedged_retry;
     bool debug_print_all_telemetry;
 };
 
@@ -38,15 +71,23 @@ class CharxPSM2 : public Everest::ModuleBase {
 public:
     CharxPSM2() = delete;
     CharxPSM2(const ModuleInfo& info, Everest::MqttProvider& mqtt_provider,
-              std::unique_ptr<power_supply_DCImplBase> p_main, Conf& config) :
-        ModuleBase(info), mqtt(mqtt_provider), p_main(std::move(p_main)), config(config){};
+              std::unique_ptr<power_supply_DCImplBase> p_main, std::unique_ptr<power_supply_DCImplBase> p_connector_2,
+              Conf& config) :
+        ModuleBase(info),
+        mqtt(mqtt_provider),
+        p_main(std::move(p_main)),
+        p_connector_2(std::move(p_connector_2)),
+        config(config){};
 
     Everest::MqttProvider& mqtt;
     const std::unique_ptr<power_supply_DCImplBase> p_main;
+    const std::unique_ptr<power_supply_DCImplBase> p_connector_2;
     const Conf& config;
 
     // ev@1fce4c5e-0ab8-41bb-90f7-14277703d2ac:v1
     // insert your public definitions here
+    // CAN bus shared by the connectors, created before the implementations are initialized
+    std::unique_ptr<PowerModuleBus> bus;
     // ev@1fce4c5e-0ab8-41bb-90f7-14277703d2ac:v1
 
 protected:
@@ -0,0 +1,53 @@
+/* license */
+#include "power_supply_DCImpl.hpp"
+#include <everest/logging.hpp>
+
+namespace module {
+namespace connector_2 {
+
+void power_supply_DCImpl::init() {
+    if (not config.enabled) {
+        return;
+    }
+    // the system broadcast reaches every module, connectors need their own groups
+    if (mod->config.broadcast_mode != 0) {
+        EVLOG_error << "connector_2 needs broadcast_mode 0 (power module groups), connector disabled";
+        return;
+    }
+
+    PowerSupplyConnector::Config connector_config;
+    connector_config.name = "connector_2";
+    connector_config.group_mode = true;
+    connector_config.group_id = config.power_module_group_id;
+    connector_config.current_limit = config.current_limit_A;
+    connector_config.voltage_limit = config.voltage_limit_V;
+    connector_config.power_limit = config.power_limit_W;
+
+    connector = std::make_unique<PowerSupplyConnector>(*mod->bus, *this, connector_config);
+}
+
+void power_supply_DCImpl::ready() {
+    if (connector) {
+        connector->start();
+    }
+}
+
+void power_supply_DCImpl::handle_setExportVoltageCurrent(double& voltage, double& current) {
+    if (connector) {
+        connector->set_export_voltage_current(voltage, current);
+    }
+}
+
+void power_supply_DCImpl::handle_setMode(types::power_supply_DC::Mode& mode,
+                                         types::power_supply_DC::ChargingPhase& phase) {
+    if (connector) {
+        connector->set_mode(mode == types::power_supply_DC::Mode::Export);
+    }
+}
+
+void power_supply_DCImpl::handle_setImportVoltageCurrent(double& voltage, double& current) {
+    // doesn't do anything
+}
+
+} // namespace connector_2
+} // namespace module
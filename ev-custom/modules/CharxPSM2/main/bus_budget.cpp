@@ -0,0 +1,32 @@
+#include "bus_budget.hpp"
+
+#include <algorithm>
+
+BusBudget::BusBudget(double frames_per_second, double burst_frames) :
+    rate(std::max(frames_per_second, 1.0)),
+    capacity(std::max(burst_frames, 1.0)),
+    tokens(capacity),
+    last_refill(Clock::now()) {
+}
+
+void BusBudget::refill() {
+    const auto now = Clock::now();
+    const std::chrono::duration<double> elapsed = now - last_refill;
+    last_refill = now;
+    tokens = std::min(capacity, tokens + elapsed.count() * rate);
+}
+
+bool BusBudget::try_acquire(double frames, double reserve) {
+    refill();
+    if (tokens - frames < reserve) {
+        ++refused;
+        return false;
+    }
+    tokens -= frames;
+    return true;
+}
+
+void BusBudget::acquire(double frames) {
+    refill();
+    tokens -= frames;
+}
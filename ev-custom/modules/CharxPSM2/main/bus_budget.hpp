@@ -0,0 +1,37 @@
+#ifndef Charx_PSM2_BUS_BUDGET_HPP
+#define Charx_PSM2_BUS_BUDGET_HPP
+
+#include <chrono>
+#include <cstdint>
+
+// Token bucket of CAN frames shared by the periodic tasks. Every task takes the frames of its requests (request
+// and expected responses) before it starts them, lower priority tasks leave a reserve for the setpoint path.
+// Not thread safe, the tasks run on the executor thread.
+class BusBudget {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // frames_per_second is the long term rate, burst_frames what may go out at once after an idle time
+    BusBudget(double frames_per_second, double burst_frames);
+
+    // false if taking the frames would leave less than reserve in the bucket, nothing is taken in this case
+    bool try_acquire(double frames, double reserve = 0);
+
+    // takes the frames even if that overdraws the bucket, for work that must not be skipped
+    void acquire(double frames);
+
+    uint64_t get_refused() const {
+        return refused;
+    }
+
+private:
+    void refill();
+
+    const double rate;
+    const double capacity;
+    double tokens;
+    Clock::time_point last_refill;
+    uint64_t refused{0};
+};
+
+#endif
@@ -1,13 +1,19 @@
 #include "can_broker.hpp"
+#include "can_broker_uring.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
 
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 #include <net/if.h>
 #include <poll.h>
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 #include <everest/logging.hpp>
 
@@ -18,8 +24,55 @@ static void throw_with_error(const std::string& msg) {
     throw std::runtime_error(msg + ": (" + std::string(strerror(errno)) + ")");
 }
 
+static std::chrono::nanoseconds to_nanoseconds(const struct timespec& ts) {
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// same clock as the software timestamps of the kernel
+static std::chrono::nanoseconds realtime_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return to_nanoseconds(ts);
+}
+
+static std::chrono::microseconds to_microseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+}
+
+// payload of the output voltage and current commands
+static std::vector<uint8_t> voltage_current_data(float voltage, float current) {
+    std::vector<uint8_t> data(8, 0);
+
+    // Convert voltage and current to mV and mA
+    uint32_t voltage_mV = static_cast<uint32_t>(voltage * 1000);
+    uint32_t current_mA = static_cast<uint32_t>(current * 1000);
+
+    // Set voltage bytes (0-3: MSB to LSB)
+    data[0] = (voltage_mV >> 24) & 0xFF;
+    data[1] = (voltage_mV >> 16) & 0xFF;
+    data[2] = (voltage_mV >> 8) & 0xFF;
+    data[3] = voltage_mV & 0xFF;
+
+    // Set current bytes (4-7: MSB to LSB)
+    data[4] = (current_mA >> 24) & 0xFF;
+    data[5] = (current_mA >> 16) & 0xFF;
+    data[6] = (current_mA >> 8) & 0xFF;
+    data[7] = current_mA & 0xFF;
+
+    return data;
+}
+
+CanBroker::CanBroker(const std::string& interface_name, const Config& config) :
+    CanBroker(interface_name, config, nullptr) {
+}
+
+CanBroker::CanBroker(const std::string& interface_name, const Config& config, Reactor& reactor) :
+    CanBroker(interface_name, config, &reactor) {
+}
+
 // Constructor for CanBroker: initializes the CAN socket and binds to the specified interface
-CanBroker::CanBroker(const std::string& interface_name) {
+CanBroker::CanBroker(const std::string& interface_name, const Config& config, Reactor* reactor) :
+    config(config), reactor(reactor) {
     // Create a socket for CAN communication
     can_fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
 
@@ -38,6 +91,24 @@ CanBroker::CanBroker(const std::string& interface_name) {
         throw_with_error("Failed with ioctl/SIOCGIFINDEX on interface " + interface_name);
     }
 
+    // Only PSM2 responses addressed to us wake up the loop thread, other bus traffic is dropped in the kernel
+    if (not install_filters()) {
+        throw_with_error("Failed with setsockopt/CAN_RAW_FILTER");
+    }
+
+    // Our own frames come back with MSG_CONFIRM once they are on the bus, this is the TX timestamp
+    const int recv_own_msgs = 1;
+    if (setsockopt(can_fd, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &recv_own_msgs, sizeof(recv_own_msgs)) == -1) {
+        EVLOG_warning << "Failed with setsockopt/CAN_RAW_RECV_OWN_MSGS, no TX timestamps: (" << strerror(errno) << ")";
+    }
+
+    // Kernel timestamps for every received frame, hardware ones if the interface supports them
+    const int timestamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+                             SOF_TIMESTAMPING_RAW_HARDWARE;
+    if (setsockopt(can_fd, SOL_SOCKET, SO_TIMESTAMPING, &timestamping, sizeof(timestamping)) == -1) {
+        EVLOG_warning << "Failed with setsockopt/SO_TIMESTAMPING, no RX timestamps: (" << strerror(errno) << ")";
+    }
+
     // Bind the socket to the CAN interface
     struct sockaddr_can addr;
     memset(&addr, 0, sizeof(addr));
@@ -48,23 +119,58 @@ CanBroker::CanBroker(const std::string& interface_name) {
         throw_with_error("Failed with bind");
     }
 
-    // Create an event file descriptor for signaling thread termination
+    // Receive buffers for recvmmsg, each message holds exactly one frame and its timestamps
+    for (std::size_t i = 0; i < RX_BATCH_SIZE; ++i) {
+        rx_iovecs[i] = {&rx_frames[i], sizeof(struct can_frame)};
+        memset(&rx_msgs[i], 0, sizeof(rx_msgs[i]));
+        rx_msgs[i].msg_hdr.msg_iov = &rx_iovecs[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        prepare_rx_msg(i);
+    }
+
+    // Create an event file descriptor for waking up the loop thread (new requests, termination)
     event_fd = eventfd(0, 0);
 
+    if (reactor) {
+        if (config.io_backend == IoBackend::IO_URING) {
+            EVLOG_warning << "io_uring CAN backend not available on the reactor, using poll";
+        }
+        attach_reactor();
+        return;
+    }
+
+    if (config.io_backend == IoBackend::IO_URING and not init_uring()) {
+        EVLOG_warning << "io_uring CAN backend not available, using poll";
+    }
+
     // Start the background loop thread
-    loop_thread = std::thread(&CanBroker::loop, this);
+    loop_thread = std::thread(uring ? &CanBroker::loop_uring : &CanBroker::loop, this);
 }
 
 // Destructor for CanBroker: cleans up resources and stops the loop thread
 CanBroker::~CanBroker() {
-    uint64_t quit_value = 1;
-    write(event_fd, &quit_value, sizeof(quit_value)); // Signal the loop thread to exit
-    loop_thread.join(); // Wait for the loop thread to finish
+    if (reactor) {
+        reactor->unwatch(can_fd);
+        reactor->unwatch(event_fd);
+        reactor->unwatch(deadline_timer->get_fd());
+    } else {
+        exit_requested = true;
+        wakeup_loop();      // Signal the loop thread to exit
+        loop_thread.join(); // Wait for the loop thread to finish
+    }
+    fail_outstanding_requests();
+    uring.reset();      // Tear down the ring before its buffers and file descriptors
     close(can_fd);      // Close the CAN socket
     close(event_fd);    // Close the event file descriptor
 }
 
-// Listen for incoming CAN frames
+bool CanBroker::install_filters() {
+    auto filters = charx::response_filters(monitor_id);
+    filters.push_back(charx::echo_filter(monitor_id));
+    return setsockopt(can_fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters.data(), filters.size() * sizeof(struct can_filter)) == 0;
+}
+
+// Listen for incoming CAN frames, expire requests which did not get a response in time and retry blocked writes
 void CanBroker::loop() {
     std::array<struct pollfd, 2> pollfds = {{
         {can_fd, POLLIN, 0},
@@ -72,55 +178,582 @@ void CanBroker::loop() {
     }};
 
     while (true) {
-        // test_end
+        const int timeout_ms = next_timeout_ms();
+        pollfds[0].events = POLLIN | (tx_wait == TxWait::WRITABLE ? POLLOUT : 0);
 
-        const auto poll_result = poll(pollfds.data(), pollfds.size(), -1);
-
-        if (poll_result == 0) {
-            // timeout
-            continue;
-        }
+        const auto poll_result = poll(pollfds.data(), pollfds.size(), timeout_ms);
 
-        if (pollfds[0].revents & POLLIN) {
+        if (poll_result > 0 and (pollfds[0].revents & POLLIN)) {
             // frame handling
-            struct can_frame frame;
-            read(can_fd, &frame, sizeof(frame));
-            handle_can_input(frame);
+            read_from_can();
         }
 
-        if (pollfds[1].revents & POLLIN) {
-            // new event, for now, we do not care, later on we could check, if it is an exit event code
+        if (poll_result > 0 and (pollfds[1].revents & POLLIN)) {
+            // new event, either new requests or the exit request
             uint64_t tmp;
             read(event_fd, &tmp, sizeof(tmp));
+            if (exit_requested) {
+                return;
+            }
+        }
+
+        // socket buffer space for blocked writes
+        if (poll_result > 0 and (pollfds[0].revents & POLLOUT)) {
+            tx_wait = TxWait::NONE;
+        }
+
+        service();
+    }
+}
+
+// Work of one loop iteration after the I/O events were handled
+void CanBroker::service() {
+    accept_submissions();
+    handle_deadlines();
+    flush_tx();
+    publish_statistics();
+}
+
+// The reactor dispatches socket, event and deadline timer, the broker work runs in its round hook
+void CanBroker::attach_reactor() {
+    deadline_timer = std::make_unique<TimerFd>();
+
+    reactor->watch(can_fd, can_events, [this](uint32_t events) {
+        if (events & EPOLLIN) {
+            read_from_can();
+        }
+        // socket buffer space for blocked writes
+        if (events & EPOLLOUT) {
+            tx_wait = TxWait::NONE;
+        }
+    });
+    reactor->watch(event_fd, EPOLLIN, [this](uint32_t) {
+        uint64_t tmp;
+        read(event_fd, &tmp, sizeof(tmp));
+    });
+    reactor->watch(deadline_timer->get_fd(), EPOLLIN, [this](uint32_t) { deadline_timer->read_expirations(); });
+    reactor->add_round_hook([this]() { return service_reactor(); });
+}
+
+// returns true if requests were taken over or completed, their callbacks may have work for other hooks
+bool CanBroker::service_reactor() {
+    const auto completed_before = completed_requests;
+    const bool accepted = accept_submissions();
+    handle_deadlines();
+    flush_tx();
+    publish_statistics();
+
+    // only touch epoll and the timer if something changed
+    const uint32_t events = EPOLLIN | (tx_wait == TxWait::WRITABLE ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if (events != can_events) {
+        can_events = events;
+        reactor->modify(can_fd, can_events);
+    }
+    const auto deadline = next_deadline();
+    if (deadline != armed_deadline) {
+        armed_deadline = deadline;
+        deadline_timer->arm_at(deadline);
+    }
+
+    return accepted or completed_requests != completed_before;
+}
+
+// next request deadline or write retry, time_point::max() if nothing is pending
+std::chrono::steady_clock::time_point CanBroker::next_deadline() {
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (const auto& [key, request] : pending_requests) {
+        next = std::min({next, request->deadline, request->retry_at});
+    }
+    for (const auto& request : queued_requests) {
+        next = std::min(next, request->deadline);
+    }
+    if (tx_wait == TxWait::RETRY) {
+        next = std::min(next, tx_retry_at);
+    }
+    if (tx_throttled_until != std::chrono::steady_clock::time_point::min()) {
+        next = std::min(next, tx_throttled_until);
+    }
+    return next;
+}
+
+// Milliseconds until the loop has to act without I/O, -1 if nothing is pending
+int CanBroker::next_timeout_ms() {
+    const auto deadline = next_deadline();
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+        return -1;
+    }
+
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    return std::max<int>(0, remaining.count());
+}
+
+// Release writes blocked by ENOBUFS or the TX ceiling and expire requests
+void CanBroker::handle_deadlines() {
+    const auto now = std::chrono::steady_clock::now();
+    if (tx_wait == TxWait::RETRY and now >= tx_retry_at) {
+        tx_wait = TxWait::NONE;
+    }
+    if (now >= tx_throttled_until) {
+        tx_throttled_until = std::chrono::steady_clock::time_point::min();
+    }
+
+    std::vector<CanRequestPtr> done;
+    std::vector<CanRequestPtr> issued;
+    expire_requests(done, issued);
+    send_requests(issued);
+    for (const auto& request : done) {
+        complete(request);
+    }
+}
+
+// Take over the requests other threads submitted, in submission order. Returns false if there were none.
+bool CanBroker::accept_submissions() {
+    std::vector<CanRequestPtr> issued;
+    bool accepted = false;
+
+    while (auto* submitted = submissions.pop()) {
+        CanRequestPtr request(submitted);
+        accepted = true;
+        if (coalesce(request)) {
+            continue;
+        }
+        const auto key = charx::request_key(request->frame);
+
+        // Only one request per command and peer can be on the bus, the responses could not be told apart otherwise.
+        // Requests to other modules or with other commands proceed in parallel.
+        if (pending_requests.count(key) == 0) {
+            issue(*request);
+            pending_requests.emplace(key, request);
+            issued.push_back(request);
+        } else {
+            queued_requests.push_back(request);
+        }
+    }
+
+    send_requests(issued);
+    return accepted;
+}
+
+// Fail everything still waiting, called once the loop thread stopped
+void CanBroker::fail_outstanding_requests() {
+    accept_submissions();
+
+    std::vector<CanRequestPtr> done;
+    for (const auto& [key, request] : pending_requests) {
+        // hedged requests waiting for their second answer were completed already
+        if (request->state == CanRequest::State::ISSUED) {
+            done.push_back(request);
+        }
+    }
+    done.insert(done.end(), queued_requests.begin(), queued_requests.end());
+    pending_requests.clear();
+    queued_requests.clear();
+
+    for (const auto& request : done) {
+        request->state = CanRequest::State::FAILED;
+        complete(request);
+    }
+}
+
+// Drain all pending frames, RX_BATCH_SIZE frames per syscall
+void CanBroker::read_from_can() {
+    while (true) {
+        for (std::size_t i = 0; i < RX_BATCH_SIZE; ++i) {
+            prepare_rx_msg(i);
+        }
+
+        const auto received = recvmmsg(can_fd, rx_msgs.data(), RX_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+        if (received == -1) {
+            if (errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR) {
+                EVLOG_error << "Failed to read CAN frames: (" << strerror(errno) << ")";
+            }
+            return;
+        }
+
+        for (int i = 0; i < received; ++i) {
+            if (rx_msgs[i].msg_len == sizeof(struct can_frame)) {
+                handle_can_input(rx_frames[i], parse_rx_info(rx_msgs[i].msg_hdr));
+            }
+        }
+
+        if (static_cast<std::size_t>(received) < RX_BATCH_SIZE) {
             return;
         }
     }
 }
 
-void CanBroker::handle_can_input(can_frame& frame) {
-    std::unique_lock<std::mutex> request_lock(request.mutex);
+void CanBroker::wakeup_loop() {
+    uint64_t value = 1;
+    write(event_fd, &value, sizeof(value));
+}
+
+// reset flags and control buffer before the message is handed to the kernel again
+void CanBroker::prepare_rx_msg(std::size_t index) {
+    auto& msg = rx_msgs[index].msg_hdr;
+    msg.msg_flags = 0;
+    msg.msg_control = rx_controls[index].data();
+    msg.msg_controllen = sizeof(rx_controls[index]);
+}
+
+CanBroker::RxInfo CanBroker::parse_rx_info(const struct msghdr& msg) {
+    RxInfo info;
+    info.echo = msg.msg_flags & MSG_CONFIRM;
+
+    for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(&msg), cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET and cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping timestamps;
+            memcpy(&timestamps, CMSG_DATA(cmsg), sizeof(timestamps));
+            // ts[0] software, ts[2] raw hardware
+            info.software_timestamp = to_nanoseconds(timestamps.ts[0]);
+            info.hardware_timestamp = to_nanoseconds(timestamps.ts[2]);
+        }
+    }
+
+    return info;
+}
+
+void CanBroker::handle_can_input(can_frame& frame, const RxInfo& info) {
+    // Our own frame is on the bus, remember when for the latency of its request
+    if (info.echo or charx::get_source(frame.can_id) == monitor_id) {
+        const auto it = pending_requests.find(charx::request_key(frame));
+        if (info.echo and it != pending_requests.end() and it->second->state == CanRequest::State::ISSUED and
+            it->second->tx_confirmed_at.count() == 0) {
+            it->second->tx_confirmed_at = info.software_timestamp;
+            it->second->tx_confirmed_hw_at = info.hardware_timestamp;
+        }
+        return;
+    }
 
+    // every response goes to the consumer, whether a request waits for it or not
+    ReceivedFrame received;
+    received.timestamp = (info.software_timestamp.count() != 0) ? info.software_timestamp : realtime_now();
+    received.command = charx::get_command(frame.can_id);
+    received.source = charx::get_source(frame.can_id);
+    received.error_code = charx::get_error_code(frame.can_id);
+    memcpy(received.data.data(), frame.data, received.data.size());
+    if (not received_frames.push(received)) {
+        rx_overruns.fetch_add(1, std::memory_order_relaxed);
+    }
 
-    // Check if we wait for response and if this is the response we are waiting for
-    if ((request.state != CanRequest::State::ISSUED) and (request.msg_type != get_msg_type(frame.can_id))) {
-    return;
+    // Check if we wait for this response at all
+    const auto request = find_request(frame);
+    if (not request) {
+        absorb_hedged_answer(frame);
+        return;
+    }
+
+    // a broadcast collecting answers waits for the remaining modules
+    if (not request->collected.empty() and not collect_response(request, frame)) {
+        return;
     }
 
-    for (auto i = 0; i < request.response.size(); ++i) {
-            request.response[i] = frame.data[i];
+    for (std::size_t i = 0; i < request->response.size(); ++i) {
+        request->response[i] = frame.data[i];
     }
 
     // Check identifier for error codes
-    handle_errors(frame.can_id);
+    if (request->collected.empty()) {
+        request->state = handle_errors(frame.can_id) ? CanRequest::State::COMPLETED : CanRequest::State::FAILED;
+    }
+
+    record_latency(*request, info);
+    record_rtt(*request, info);
+
+    // Issue requests which waited for this key, then report the result. A hedged request keeps its slot until the
+    // answer to its second frame arrived or the deadline passed, that answer would complete the next request.
+    std::vector<CanRequestPtr> issued;
+    if (not request->hedged) {
+        release_slot(charx::request_key(request->frame), issued);
+    }
+    send_requests(issued);
+    complete(request);
+}
+
+std::size_t CanBroker::drain_received(const std::function<void(const ReceivedFrame&)>& handler) {
+    std::size_t count = 0;
+    ReceivedFrame frame;
+    while (received_frames.pop(frame)) {
+        handler(frame);
+        ++count;
+    }
+    return count;
+}
+
+uint64_t CanBroker::get_rx_overruns() const {
+    return rx_overruns.load(std::memory_order_relaxed);
+}
+
+// Account the latencies of a completed request
+void CanBroker::record_latency(const CanRequest& request, const RxInfo& info) {
+    if (info.software_timestamp.count() == 0) {
+        return;
+    }
+    statistics_changed = true;
+
+    auto& sums = latencies[charx::get_command(request.frame.can_id)];
+    ++sums.samples;
+
+    const auto wakeup = realtime_now() - info.software_timestamp;
+    sums.wakeup_sum += wakeup;
+    sums.wakeup_max = std::max(sums.wakeup_max, wakeup);
+
+    if (request.tx_confirmed_at.count() == 0) {
+        return;
+    }
+
+    const auto tx_delay = request.tx_confirmed_at - request.queued_at;
+    sums.tx_delay_sum += tx_delay;
+    sums.tx_delay_max = std::max(sums.tx_delay_max, tx_delay);
+
+    // hardware timestamps are more precise, but only comparable with each other
+    const bool hardware = request.tx_confirmed_hw_at.count() != 0 and info.hardware_timestamp.count() != 0;
+    const auto bus = hardware ? info.hardware_timestamp - request.tx_confirmed_hw_at
+                              : info.software_timestamp - request.tx_confirmed_at;
+    ++sums.bus_samples;
+    sums.bus_sum += bus;
+    sums.bus_min = std::min(sums.bus_min, bus);
+    sums.bus_max = std::max(sums.bus_max, bus);
+}
+
+std::map<uint8_t, CanBroker::LatencyStatistics> CanBroker::get_latency_statistics() {
+    std::lock_guard<std::mutex> statistics_lock(statistics_mtx);
+    return statistics_snapshot;
+}
+
+std::array<CanBroker::TxStatistics, CanBroker::TX_CLASS_COUNT> CanBroker::get_tx_statistics() {
+    std::lock_guard<std::mutex> statistics_lock(statistics_mtx);
+    return tx_statistics_snapshot;
+}
+
+// Refresh the snapshot for get_latency_statistics(), skipped while a reader holds it
+void CanBroker::publish_statistics() {
+    if (not statistics_changed) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> statistics_lock(statistics_mtx, std::try_to_lock);
+    if (not statistics_lock.owns_lock()) {
+        return;
+    }
+
+    auto& statistics = statistics_snapshot;
+    statistics.clear();
+    for (const auto& [command, sums] : latencies) {
+        auto& entry = statistics[command];
+        entry.samples = sums.samples;
+        entry.hedged_retries = sums.hedged_retries;
+        entry.timeout = rtt_per_command[command].timeout(config.timeouts);
+        if (sums.samples == 0) {
+            continue;
+        }
+        entry.wakeup_avg = to_microseconds(sums.wakeup_sum / sums.samples);
+        entry.wakeup_max = to_microseconds(sums.wakeup_max);
+        if (sums.bus_samples > 0) {
+            entry.bus_min = to_microseconds(sums.bus_min);
+            entry.bus_max = to_microseconds(sums.bus_max);
+            entry.bus_avg = to_microseconds(sums.bus_sum / sums.bus_samples);
+            entry.tx_delay_avg = to_microseconds(sums.tx_delay_sum / sums.bus_samples);
+            entry.tx_delay_max = to_microseconds(sums.tx_delay_max);
+        }
+    }
+    tx_statistics_snapshot = tx_statistics;
+    statistics_changed = false;
+}
+
+// Put a request on the bus with a timeout derived from its round trip times
+void CanBroker::issue(CanRequest& request) {
+    const auto key = charx::request_key(request.frame);
+    const auto command = charx::get_command(request.frame.can_id);
+
+    const auto by_key = rtt_per_request_key.find(key);
+    const auto& rtt = (by_key != rtt_per_request_key.end() and by_key->second.has_estimate())
+                          ? by_key->second
+                          : rtt_per_command[command];
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto timeout = rtt.timeout(config.timeouts);
+
+    request.state = CanRequest::State::ISSUED;
+    request.queued_at = realtime_now();
+    request.deadline = now + timeout;
+    request.retry_at = std::chrono::steady_clock::time_point::max();
+
+    // a second broadcast would make every module answer again
+    if (config.hedged_retry and request.collected.empty() and rtt.has_estimate() and rtt.p99() < timeout) {
+        request.retry_at = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(rtt.p99());
+    }
+}
+
+// Round trip time of a completed request
+void CanBroker::record_rtt(const CanRequest& request, const RxInfo& info) {
+    const auto received_at = (info.software_timestamp.count() != 0) ? info.software_timestamp : realtime_now();
+    const auto rtt = received_at - request.queued_at;
+
+    rtt_per_request_key[charx::request_key(request.frame)].add_sample(rtt);
+    rtt_per_command[charx::get_command(request.frame.can_id)].add_sample(rtt);
+    statistics_changed = true;
+}
+
+// A timeout counts as a round trip time at the ceiling. Otherwise a destination that stops answering keeps the
+// estimate of its last answers, it would be hedged and time out early on every request. Broadcasts collecting
+// answers are left out, they wait for missing modules until the deadline by design. The command wide estimate
+// only learns from answers, so one slow module does not stretch the timeouts of the others.
+void CanBroker::record_timeout(const CanRequest& request) {
+    if (not request.collected.empty()) {
+        return;
+    }
+    rtt_per_request_key[charx::request_key(request.frame)].add_sample(config.timeouts.ceiling);
+    statistics_changed = true;
+}
+
+// Match a received frame to the request waiting for it
+CanBroker::CanRequestPtr CanBroker::find_request(const can_frame& frame) {
+    if (not(frame.can_id & CAN_EFF_FLAG) or charx::get_destination(frame.can_id) != monitor_id) {
+        return nullptr;
+    }
+
+    const auto command = charx::get_command(frame.can_id);
+
+    // responses carry the answering module as source, broadcast requests accept any of them. A collecting
+    // broadcast that already has the answer of this module leaves it to a group request of the same command.
+    const auto source = charx::get_source(frame.can_id);
+    for (const auto peer : {source, broadcast_adr}) {
+        const auto it = pending_requests.find(charx::request_key(command, peer));
+        if (it != pending_requests.end() and it->second->state == CanRequest::State::ISSUED and
+            awaits_answer(*it->second, source)) {
+            return it->second;
+        }
+    }
+
+    // group requests, the answer does not tell the group but the module is one of the collected
+    for (const auto& [key, request] : pending_requests) {
+        if (request->state == CanRequest::State::ISSUED and not request->collected.empty() and
+            charx::get_command(request->frame.can_id) == command and awaits_answer(*request, source)) {
+            return request;
+        }
+    }
+
+    return nullptr;
+}
+
+// Requests for a single answer take any, collecting ones only the first answer of each expected module
+bool CanBroker::awaits_answer(const CanRequest& request, uint8_t source) {
+    if (request.collected.empty()) {
+        return true;
+    }
+    return std::any_of(request.collected.begin(), request.collected.end(), [source](const ModuleResponse& response) {
+        return response.module_address == source and response.status == AccessReturnType::TIMEOUT;
+    });
+}
+
+// The second answer to a completed hedged request, the next request of its key can go out now
+void CanBroker::absorb_hedged_answer(const can_frame& frame) {
+    if (not(frame.can_id & CAN_EFF_FLAG) or charx::get_destination(frame.can_id) != monitor_id) {
+        return;
+    }
+
+    const auto command = charx::get_command(frame.can_id);
+    for (const auto peer : {charx::get_source(frame.can_id), broadcast_adr}) {
+        const auto key = charx::request_key(command, peer);
+        const auto it = pending_requests.find(key);
+        if (it != pending_requests.end() and it->second->hedged and
+            it->second->state != CanRequest::State::ISSUED) {
+            std::vector<CanRequestPtr> issued;
+            release_slot(key, issued);
+            send_requests(issued);
+            return;
+        }
+    }
+}
+
+// Remove the finished request with this key from the table and promote the next queued one
+void CanBroker::release_slot(uint16_t key, std::vector<CanRequestPtr>& issued) {
+    pending_requests.erase(key);
+
+    const auto next = std::find_if(queued_requests.begin(), queued_requests.end(),
+                                   [key](const CanRequestPtr& request) { return charx::request_key(request->frame) == key; });
+    if (next == queued_requests.end()) {
+        return;
+    }
 
-    request.state = CanRequest::State::COMPLETED;
+    issue(**next);
+    pending_requests.emplace(key, *next);
+    issued.push_back(*next);
+    queued_requests.erase(next);
+}
+
+void CanBroker::expire_requests(std::vector<CanRequestPtr>& done, std::vector<CanRequestPtr>& issued) {
+    const auto now = std::chrono::steady_clock::now();
+
+    // requests on the bus without response
+    for (auto it = pending_requests.begin(); it != pending_requests.end();) {
+        const auto request = (it++)->second;
+
+        // the response is later than usual, send the request once more instead of waiting for the full timeout
+        if (request->state == CanRequest::State::ISSUED and request->retry_at <= now and request->deadline > now) {
+            request->retry_at = std::chrono::steady_clock::time_point::max();
+            request->hedged = true;
+            ++latencies[charx::get_command(request->frame.can_id)].hedged_retries;
+            statistics_changed = true;
+            issued.push_back(request);
+            continue;
+        }
+
+        if (request->state == CanRequest::State::ISSUED and request->deadline <= now) {
+            EVLOG_info << "TIMEOUT";
+            request->state = CanRequest::State::TIMEOUT;
+            record_timeout(*request);
+            done.push_back(request);
+            release_slot(charx::request_key(request->frame), issued);
+            continue;
+        }
+
+        // completed hedged request whose second answer did not come
+        if (request->hedged and request->deadline <= now) {
+            release_slot(charx::request_key(request->frame), issued);
+        }
+    }
+
+    // requests that never got a free slot
+    for (auto it = queued_requests.begin(); it != queued_requests.end();) {
+        if ((*it)->deadline <= now) {
+            (*it)->state = CanRequest::State::NOT_READY;
+            done.push_back(*it);
+            it = queued_requests.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
 
-    // Unlock for dispatch_frame to proceed
-    request_lock.unlock();
-    request.cv.notify_one();
+void CanBroker::complete(const CanRequestPtr& request) {
+    ++completed_requests;
+    if (request->on_collected) {
+        request->on_collected(to_access_return_type(request->state), request->collected);
+        return;
+    }
+    uint64_t response;
+    memcpy(&response, request->response.data(), sizeof(response));
+    if (request->on_completion) {
+        request->on_completion(to_access_return_type(request->state), response);
+    }
 }
 
-void CanBroker::handle_errors(uint32_t can_id) {
+CanBroker::AccessReturnType CanBroker::to_access_return_type(CanRequest::State state) {
+    switch (state) {
+    case CanRequest::State::COMPLETED:
+        return AccessReturnType::SUCCESS;
+    case CanRequest::State::TIMEOUT:
+        return AccessReturnType::TIMEOUT;
+    case CanRequest::State::NOT_READY:
+        return AccessReturnType::NOT_READY;
+    default:
+        return AccessReturnType::FAILED;
+    }
+}
+
+// returns false, if the response reports a rejected command
+bool CanBroker::handle_errors(uint32_t can_id) {
     // delete extended frame flag
     can_id &= 0x1FFFFFFF;
     // get error_code
@@ -128,179 +761,363 @@ void CanBroker::handle_errors(uint32_t can_id) {
     // handle error code
     if (error_code == 0) {
         // normal code
-        return;
+        return true;
     }
     if (error_code == 2) {
         // command invalid
         EVLOG_warning << "can response: command invalid";
-        return;
+        return false;
     }
     if (error_code == 3) {
         // data invalid
         EVLOG_warning << "can response: data invalid";
-        return;
+        return false;
     }
     if (error_code == 7) {
         // data invalid
         // EVLOG_warning << "can response: start of processing";
-        return;
+        return true;
     }
+    return true;
 }
 
 // Try to establish connection, read number of power modules
 void CanBroker::read_number_of_modules(bool& power_modules_connected, uint8_t& actual_number_of_pwr_mdls) {
+    auto call = std::make_shared<BlockingCall>();
+
+    read_number_of_modules_async([&, call](AccessReturnType status, uint8_t number_of_pwr_mdls) {
+        if (status == CanBroker::AccessReturnType::SUCCESS) {
+            power_modules_connected = true;
+            actual_number_of_pwr_mdls = number_of_pwr_mdls;
+        }
+        call->finish(status);
+    });
+
+    call->wait();
+}
+
+void CanBroker::read_number_of_modules_async(NumberOfModulesCallback callback) {
     struct can_frame frame;
     std::vector<uint8_t> data(8, 0);
-    uint64_t response;
 
     charx::prepare_frame(frame, monitor_id, broadcast_adr, charx::def::Command::SYSTEM_READ_MAX_VALUES, data); // Dunno why its called max values, returns number of power modules
-    const auto status = dispatch_frame(frame, &response);
 
+    dispatch_frame_async(frame, [callback = std::move(callback)](AccessReturnType status, uint64_t response) {
+        uint8_t actual_number_of_pwr_mdls = 0;
 
-    if (status == CanBroker::AccessReturnType::SUCCESS) {
-        response = __builtin_bswap64(response);
+        if (status == CanBroker::AccessReturnType::SUCCESS) {
+            response = __builtin_bswap64(response);
 
-        EVLOG_info << std::hex << response;
+            EVLOG_info << std::hex << response;
 
-        power_modules_connected = true;
-        actual_number_of_pwr_mdls = (response >> 40) & 0xFF;
-        EVLOG_info << "Power modules connected";
-        EVLOG_info << "Number of connected power modules: " << static_cast<int>(actual_number_of_pwr_mdls);
-    }
+            actual_number_of_pwr_mdls = (response >> 40) & 0xFF;
+            EVLOG_info << "Power modules connected";
+            EVLOG_info << "Number of connected power modules: " << static_cast<int>(actual_number_of_pwr_mdls);
+        }
+        callback(status, actual_number_of_pwr_mdls);
+    });
 }
 
 // Read individual power module statuses
 CanBroker::AccessReturnType CanBroker::read_power_module_status(uint8_t module_address, std::array<uint8_t, 5>& status_list) {
+    auto call = std::make_shared<BlockingCall>();
+
+    read_power_module_status_async(module_address, [&, call](AccessReturnType status, const std::array<uint8_t, 5>& statuses) {
+        if (status == CanBroker::AccessReturnType::SUCCESS) {
+            status_list = statuses;
+        }
+        call->finish(status);
+    });
+
+    return call->wait();
+}
+
+void CanBroker::read_power_module_status_async(uint8_t module_address, ModuleStatusCallback callback) {
     struct can_frame frame;
     std::vector<uint8_t> data(8, 0);
-    uint64_t response;
 
     charx::prepare_frame(frame, monitor_id, module_address, 
                          charx::def::Command::MODULE_READ_STATUS, 
                          data);
 
-    const auto status = dispatch_frame(frame, &response);
+    dispatch_frame_async(frame, [module_address, callback = std::move(callback)](AccessReturnType status, uint64_t response) {
+        std::array<uint8_t, 5> status_list{};
 
-    if (status == CanBroker::AccessReturnType::SUCCESS) {
-        EVLOG_info << "Power Module" << static_cast<int>(module_address) << " read sucesfully";
-        charx::parse_statuses(status_list, response);
-    }
-    return status;
+        if (status == CanBroker::AccessReturnType::SUCCESS) {
+            EVLOG_info << "Power Module" << static_cast<int>(module_address) << " read sucesfully";
+            charx::parse_statuses(status_list, response);
+        }
+        callback(status, status_list);
+    });
 }
 
-// Set system (broadcast) output voltage and current
-CanBroker::AccessReturnType  CanBroker::set_system_voltage_current(const float& voltage, const float& current) {
+// Read the information block of a power module, the data is handed over as received
+void CanBroker::read_module_info_async(uint8_t module_address, ModuleInfoCallback callback) {
     struct can_frame frame;
     std::vector<uint8_t> data(8, 0);
-    uint64_t response;
 
-    // Convert voltage and current to mV and mA
-    uint32_t voltage_mV = static_cast<uint32_t>(voltage * 1000);
-    uint32_t current_mA = static_cast<uint32_t>(current * 1000);
+    charx::prepare_frame(frame, monitor_id, module_address, charx::def::Command::READ_MODULE_INFO, data);
 
-    // Set voltage bytes (0-3: MSB to LSB)
-    data[0] = (voltage_mV >> 24) & 0xFF;
-    data[1] = (voltage_mV >> 16) & 0xFF;
-    data[2] = (voltage_mV >> 8) & 0xFF;
-    data[3] = voltage_mV & 0xFF;
+    dispatch_frame_async(frame, [callback = std::move(callback)](AccessReturnType status, uint64_t response) {
+        std::array<uint8_t, 8> info{};
+        if (status == CanBroker::AccessReturnType::SUCCESS) {
+            memcpy(info.data(), &response, info.size());
+        }
+        callback(status, info);
+    });
+}
 
-    // Set current bytes (4-7: MSB to LSB)
-    data[4] = (current_mA >> 24) & 0xFF;
-    data[5] = (current_mA >> 16) & 0xFF;
-    data[6] = (current_mA >> 8) & 0xFF;
-    data[7] = current_mA & 0xFF;
+void CanBroker::read_power_module_statuses_async(const std::vector<uint8_t>& module_addresses,
+                                                 ModuleStatusesCallback callback) {
+    struct can_frame frame;
+    std::vector<uint8_t> data(8, 0);
+
+    charx::prepare_frame(frame, monitor_id, broadcast_adr, charx::def::Command::MODULE_READ_STATUS, data);
+
+    collect_frame_async(frame, module_addresses,
+                        [callback = std::move(callback)](AccessReturnType status,
+                                                         const std::vector<ModuleResponse>& responses) {
+                            std::vector<ModuleStatus> statuses;
+                            for (const auto& response : responses) {
+                                ModuleStatus& module_status = statuses.emplace_back();
+                                module_status.module_address = response.module_address;
+                                module_status.status = response.status;
+                                if (response.status == AccessReturnType::SUCCESS) {
+                                    uint64_t raw;
+                                    memcpy(&raw, response.data.data(), sizeof(raw));
+                                    charx::parse_statuses(module_status.status_list, raw);
+                                }
+                            }
+                            callback(status, statuses);
+                        });
+}
+
+void CanBroker::read_module_voltages_currents_async(const std::vector<uint8_t>& module_addresses,
+                                                    ModuleVoltagesCurrentsCallback callback) {
+    struct can_frame frame;
+    std::vector<uint8_t> data(8, 0);
+
+    charx::prepare_frame(frame, monitor_id, broadcast_adr, charx::def::Command::MODULE_READ_ACTUAL_VALUES, data);
+    collect_voltages_currents_async(frame, module_addresses, std::move(callback));
+}
+
+void CanBroker::set_module_state_async(uint8_t module_address, bool enabled, StatusCallback callback) {
+    struct can_frame frame;
+    std::vector<uint8_t> data(8, 0);
+
+    data[0] = enabled ? 0x00 : 0x01;
+
+    charx::prepare_frame(frame, monitor_id, module_address, charx::def::Command::SWITCH_OPERATIONAL_READINESS, data);
+    dispatch_frame_async(frame, [callback = std::move(callback)](AccessReturnType status, uint64_t) { callback(status); });
+}
+
+void CanBroker::set_module_voltage_current_async(uint8_t module_address, float voltage, float current,
+                                                 StatusCallback callback) {
+    struct can_frame frame;
+    const auto data = voltage_current_data(voltage, current);
+
+    charx::prepare_frame(frame, monitor_id, module_address, charx::def::Command::SET_MODULE_OUTPUT_VOLTAGE_AND_CURRENT,
+                         data);
+    dispatch_frame_async(frame, [callback = std::move(callback)](AccessReturnType status, uint64_t) { callback(status); });
+}
+
+void CanBroker::set_group_state_async(uint8_t group, const std::vector<uint8_t>& module_addresses, bool enabled,
+                                      StatusCallback callback) {
+    struct can_frame frame;
+    std::vector<uint8_t> data(8, 0);
+
+    EVLOG_info << "setting power module group " << static_cast<int>(group) << (enabled ? " on" : " off");
+    data[0] = enabled ? 0x00 : 0x01;
+
+    charx::prepare_group_frame(frame, monitor_id, group, charx::def::Command::SWITCH_OPERATIONAL_READINESS, data);
+    collect_frame_async(frame, module_addresses,
+                        [callback = std::move(callback)](AccessReturnType status, const std::vector<ModuleResponse>&) {
+                            callback(status);
+                        });
+}
+
+void CanBroker::set_group_voltage_current_async(uint8_t group, const std::vector<uint8_t>& module_addresses,
+                                                float voltage, float current, StatusCallback callback) {
+    struct can_frame frame;
+    const auto data = voltage_current_data(voltage, current);
+
+    // the system command addressed to a group sets the output of the group
+    charx::prepare_group_frame(frame, monitor_id, group, charx::def::Command::SET_SYSTEM_OUTPUT_VOLTAGE_AND_CURRENT,
+                               data);
+    collect_frame_async(frame, module_addresses,
+                        [callback = std::move(callback)](AccessReturnType status, const std::vector<ModuleResponse>&) {
+                            callback(status);
+                        });
+}
+
+void CanBroker::read_group_voltages_currents_async(uint8_t group, const std::vector<uint8_t>& module_addresses,
+                                                   ModuleVoltagesCurrentsCallback callback) {
+    struct can_frame frame;
+    std::vector<uint8_t> data(8, 0);
+
+    charx::prepare_group_frame(frame, monitor_id, group, charx::def::Command::MODULE_READ_ACTUAL_VALUES, data);
+    collect_voltages_currents_async(frame, module_addresses, std::move(callback));
+}
+
+void CanBroker::collect_voltages_currents_async(const can_frame& frame, const std::vector<uint8_t>& module_addresses,
+                                                ModuleVoltagesCurrentsCallback callback) {
+    collect_frame_async(frame, module_addresses,
+                        [callback = std::move(callback)](AccessReturnType status,
+                                                         const std::vector<ModuleResponse>& responses) {
+                            std::vector<ModuleVoltageCurrent> values;
+                            for (const auto& response : responses) {
+                                ModuleVoltageCurrent& value = values.emplace_back();
+                                value.module_address = response.module_address;
+                                value.status = response.status;
+                                if (response.status == AccessReturnType::SUCCESS) {
+                                    uint64_t raw;
+                                    memcpy(&raw, response.data.data(), sizeof(raw));
+                                    charx::parse_voltagecurrent(value.voltage, value.current, raw);
+                                }
+                            }
+                            callback(status, values);
+                        });
+}
+
+// Set system (broadcast) output voltage and current
+CanBroker::AccessReturnType  CanBroker::set_system_voltage_current(const float& voltage, const float& current) {
+    auto call = std::make_shared<BlockingCall>();
 
+    set_system_voltage_current_async(voltage, current, [call](AccessReturnType status) { call->finish(status); });
+
+    return call->wait();
+}
+
+void CanBroker::set_system_voltage_current_async(float voltage, float current, StatusCallback callback) {
+    struct can_frame frame;
+    const auto data = voltage_current_data(voltage, current);
 
     // Prepare frame with broadcast addressing
     charx::prepare_frame(frame, monitor_id, broadcast_adr, 
                          charx::def::Command::SET_SYSTEM_OUTPUT_VOLTAGE_AND_CURRENT, 
                          data);
 
-    const auto status = dispatch_frame(frame, &response);
-
-    if (status == CanBroker::AccessReturnType::SUCCESS) {
-        EVLOG_info << "System voltage and current set";
-    }
-    return status;
+    dispatch_frame_async(frame, [callback = std::move(callback)](AccessReturnType status, uint64_t) {
+        if (status == CanBroker::AccessReturnType::SUCCESS) {
+            EVLOG_info << "System voltage and current set";
+        }
+        callback(status);
+    });
 }
 
 // read system (broadcast) voltage and current
 CanBroker::AccessReturnType CanBroker::read_system_voltage_current(float& voltage, float& current) {
+    auto call = std::make_shared<BlockingCall>();
+
+    read_system_voltage_current_async([&, call](AccessReturnType status, float read_voltage, float read_current) {
+        if (status == CanBroker::AccessReturnType::SUCCESS) {
+            voltage = read_voltage;
+            current = read_current;
+        }
+        call->finish(status);
+    });
+
+    return call->wait();
+}
+
+void CanBroker::read_system_voltage_current_async(VoltageCurrentCallback callback) {
     struct can_frame frame;
     std::vector<uint8_t> data(8, 0);
-    uint64_t response;
 
     // Prepare frame with broadcast addressing
     charx::prepare_frame(frame, monitor_id, broadcast_adr, 
                          charx::def::Command::SYSTEM_READ_ACTUAL_VALUES, 
                          data);
 
-    const auto status = dispatch_frame(frame, &response);
+    dispatch_frame_async(frame, [callback = std::move(callback)](AccessReturnType status, uint64_t response) {
+        float voltage = 0;
+        float current = 0;
 
-    if (status == CanBroker::AccessReturnType::SUCCESS) {
-        charx::parse_voltagecurrent(voltage, current, response);
-    }
-    return status;
+        if (status == CanBroker::AccessReturnType::SUCCESS) {
+            charx::parse_voltagecurrent(voltage, current, response);
+        }
+        callback(status, voltage, current);
+    });
 }
 
-// send frame, wait for response, adjust message status
-CanBroker::AccessReturnType CanBroker::dispatch_frame(const can_frame& frame, uint64_t* response) {
-    // Sends frame and waits for response
-    std::lock_guard<std::mutex> access_lock(access_mtx);
-
-    std::unique_lock<std::mutex> request_lock(request.mutex);
-
-    // sends frame
-    write_to_can(frame);
-
-    request.id = invert_src_dst(frame.can_id);
-    request.msg_type = get_msg_type(request.id);
+// queue frame, the callback is invoked on response, timeout or when no slot got free in time
+void CanBroker::dispatch_frame_async(const can_frame& frame, ResponseCallback callback) {
+    // owned by the broker thread once it took the request from the submission queue
+    auto* request = new CanRequest();
+    request->frame = frame;
+    request->on_completion = std::move(callback);
+    submit(request);
+}
 
-    request.state = CanRequest::State::ISSUED;
+// Queue a broadcast frame and gather the answers of the listed modules. The callback is invoked once all of them
+// answered or at the deadline, modules without answer are reported as TIMEOUT.
+void CanBroker::collect_frame_async(const can_frame& frame, const std::vector<uint8_t>& module_addresses,
+                                    CollectCallback callback) {
+    if (module_addresses.empty()) {
+        callback(AccessReturnType::SUCCESS, {});
+        return;
+    }
 
-    const auto finished = request.cv.wait_for(request_lock, ACCESS_TIMEOUT,
-                                              [this]() { return request.state != CanRequest::State::ISSUED; });
-                                            
-    if (not finished) {
-        EVLOG_info << "TIMEOUT";
-        return AccessReturnType::TIMEOUT;
+    auto* request = new CanRequest();
+    request->frame = frame;
+    for (const auto module_address : module_addresses) {
+        request->collected.push_back({module_address});
     }
+    request->on_collected = std::move(callback);
+    submit(request);
+}
 
-    if (request.state == CanRequest::State::FAILED) {
-        return AccessReturnType::FAILED;
+// Record the answer of one module to a collecting broadcast, returns true once all expected modules answered
+bool CanBroker::collect_response(const CanRequestPtr& request, const can_frame& frame) {
+    const auto source = charx::get_source(frame.can_id);
+    const auto it = std::find_if(request->collected.begin(), request->collected.end(),
+                                 [source](const ModuleResponse& response) { return response.module_address == source; });
+    if (it == request->collected.end() or it->status != AccessReturnType::TIMEOUT) {
+        // not asked for or a repeated answer
+        return false;
     }
 
-    // success
-    if (response) {
-        memcpy(response, request.response.data(), sizeof(std::remove_pointer_t<decltype(response)>));
+    it->status = handle_errors(frame.can_id) ? AccessReturnType::SUCCESS : AccessReturnType::FAILED;
+    memcpy(it->data.data(), frame.data, it->data.size());
+    if (++request->answered < request->collected.size()) {
+        return false;
     }
 
-    return AccessReturnType::SUCCESS;
+    const bool all_succeeded = std::all_of(request->collected.begin(), request->collected.end(),
+                                           [](const ModuleResponse& response) {
+                                               return response.status == AccessReturnType::SUCCESS;
+                                           });
+    request->state = all_succeeded ? CanRequest::State::COMPLETED : CanRequest::State::FAILED;
+    return true;
 }
 
-// invert source and destination adresses, use for response identification
-uint32_t CanBroker::invert_src_dst(uint32_t can_id) {
-    uint32_t src = can_id & 0x000000FF;
-    uint32_t dst = (can_id & 0x0000FF00) >> 8;
+// Hand a request to the broker thread
+void CanBroker::submit(CanRequest* request) {
+    // deadline while queued behind a request of the same key, that one times out after the ceiling at the latest
+    request->deadline = std::chrono::steady_clock::now() + config.timeouts.ceiling;
+    request->tx_class = tx_class(request->frame);
 
-    uint32_t swapped_bits = (src << 8) | dst;
+    // the broker thread registers the request before it sends the frame, so an early response cannot be missed
+    submissions.push(request);
 
-    can_id &= 0xFFFF0000;
-    can_id |= swapped_bits;
-    return can_id;
-}
-
-// get only message type
-uint32_t CanBroker::get_msg_type(uint32_t identifier) {
-    uint32_t msg_type = identifier << 3; 
-    return msg_type;
+    // on the reactor thread the round hook picks the request up anyway
+    if (not(reactor and reactor->in_reactor_thread())) {
+        wakeup_loop();
+    }
 }
 
 // Set the operational readiness of the device (enabled or disabled)
 void CanBroker::set_state(bool enabled) {
+    auto call = std::make_shared<BlockingCall>();
+
+    set_state_async(enabled, [call](AccessReturnType status) { call->finish(status); });
+
+    call->wait();
+}
+
+void CanBroker::set_state_async(bool enabled, StatusCallback callback) {
     struct can_frame frame;
     std::vector<uint8_t> data(8, 0);
-    uint64_t response;
 
     if (enabled == true) {
         EVLOG_info << "setting power modules on";
@@ -313,13 +1130,255 @@ void CanBroker::set_state(bool enabled) {
 
     charx::prepare_frame(frame, monitor_id, broadcast_adr, charx::def::Command::SWITCH_OPERATIONAL_READINESS, data); // Prepares a frame for the command
     
-    const auto status = dispatch_frame(frame, &response);
+    dispatch_frame_async(frame, [callback = std::move(callback)](AccessReturnType status, uint64_t) { callback(status); });
+}
 
-    if (status == CanBroker::AccessReturnType::SUCCESS) {
+// Queue the frame of a request behind the frames of its class, returns false if there is no room. Reads are
+// refused before the queue is full and while the socket is blocked with a batch waiting, so they push back on the
+// periodic tasks and mode and setpoint frames always find room.
+bool CanBroker::enqueue_tx(const CanRequestPtr& request) {
+    const auto index = static_cast<std::size_t>(request->tx_class);
+    const bool read = request->tx_class >= TxClass::SYSTEM_TELEMETRY;
+    const bool blocked = tx_wait != TxWait::NONE and tx_queued >= TX_BATCH_SIZE;
+
+    if (tx_queued >= TX_QUEUE_LIMIT or (read and (tx_queued >= TX_READ_LIMIT or blocked))) {
+        if (not read) {
+            EVLOG_warning << "CAN TX queue full, frame dropped";
+        }
+        ++tx_statistics[index].rejected;
+        statistics_changed = true;
+        return false;
     }
+
+    tx_queues[index].push_back({request->frame, request});
+    ++tx_queued;
+    return true;
 }
 
-// Write a CAN frame to the socket
-void CanBroker::write_to_can(const struct can_frame& frame) {
-    write(can_fd, &frame, sizeof(frame)); // Send the frame to the CAN bus
-}
\ No newline at end of file
+// Take the next frame to send in class order. Frames of requests that finished meanwhile are dropped, reads wait
+// while the TX ceiling is used up. Returns false if no frame may go out now.
+bool CanBroker::take_tx(TxEntry& entry) {
+    const auto now = std::chrono::steady_clock::now();
+    refill_tx_tokens(now);
+
+    for (std::size_t index = 0; index < TX_CLASS_COUNT; ++index) {
+        auto& queue = tx_queues[index];
+        auto& statistics = tx_statistics[index];
+
+        // timed out, answered by an earlier copy of the frame or failed
+        while (not queue.empty() and queue.front().request->state != CanRequest::State::ISSUED) {
+            queue.pop_front();
+            --tx_queued;
+            ++statistics.dropped_stale;
+            statistics_changed = true;
+        }
+        if (queue.empty()) {
+            continue;
+        }
+
+        const bool read = static_cast<TxClass>(index) >= TxClass::SYSTEM_TELEMETRY;
+        if (read and config.tx_ceiling_frames_per_s > 0 and tx_tokens < 1) {
+            // the classes below are reads as well, retry once the next token is in
+            if (tx_throttled_until == std::chrono::steady_clock::time_point::min()) {
+                ++statistics.throttled;
+                statistics_changed = true;
+            }
+            const std::chrono::duration<double> wait((1 - tx_tokens) / config.tx_ceiling_frames_per_s);
+            tx_throttled_until = now + std::chrono::ceil<std::chrono::steady_clock::duration>(wait);
+            return false;
+        }
+
+        // mode and setpoint frames take their token even if that overdraws the bucket
+        entry = std::move(queue.front());
+        queue.pop_front();
+        --tx_queued;
+        tx_tokens -= 1;
+        ++statistics.sent;
+        return true;
+    }
+
+    return false;
+}
+
+// Put a frame the socket did not take back to the front of its class
+void CanBroker::requeue_tx(TxEntry&& entry) {
+    const auto index = static_cast<std::size_t>(entry.request->tx_class);
+    --tx_statistics[index].sent;
+    tx_tokens += 1;
+    tx_queues[index].push_front(std::move(entry));
+    ++tx_queued;
+}
+
+void CanBroker::refill_tx_tokens(std::chrono::steady_clock::time_point now) {
+    if (config.tx_ceiling_frames_per_s <= 0) {
+        return;
+    }
+
+    const std::chrono::duration<double> burst = TX_CEILING_BURST;
+    const std::chrono::duration<double> elapsed = now - tx_tokens_at;
+    const auto capacity = std::max(config.tx_ceiling_frames_per_s * burst.count(), 1.0);
+    tx_tokens = std::min(capacity, tx_tokens + elapsed.count() * config.tx_ceiling_frames_per_s);
+    tx_tokens_at = now;
+}
+
+// A read identical to one queued or on the bus shares its response instead of going out once more. Returns true
+// if the request was attached to the other one.
+bool CanBroker::coalesce(const CanRequestPtr& request) {
+    if (request->tx_class < TxClass::SYSTEM_TELEMETRY or not request->collected.empty()) {
+        return false;
+    }
+
+    const auto same_frame = [&request](const CanRequestPtr& other) {
+        return other->collected.empty() and other->frame.can_id == request->frame.can_id and other->frame.can_dlc == request->frame.can_dlc and
+               memcmp(other->frame.data, request->frame.data, request->frame.can_dlc) == 0;
+    };
+
+    CanRequestPtr target;
+    const auto pending = pending_requests.find(charx::request_key(request->frame));
+    if (pending != pending_requests.end() and pending->second->state == CanRequest::State::ISSUED and
+        same_frame(pending->second)) {
+        target = pending->second;
+    } else {
+        const auto queued = std::find_if(queued_requests.begin(), queued_requests.end(), same_frame);
+        if (queued == queued_requests.end()) {
+            return false;
+        }
+        target = *queued;
+    }
+
+    target->on_completion = [first = std::move(target->on_completion),
+                             second = std::move(request->on_completion)](AccessReturnType status, uint64_t response) {
+        if (first) {
+            first(status, response);
+        }
+        if (second) {
+            second(status, response);
+        }
+    };
+    ++tx_statistics[static_cast<std::size_t>(request->tx_class)].coalesced;
+    statistics_changed = true;
+    return true;
+}
+
+// Traffic class of a frame, derived from its command
+CanBroker::TxClass CanBroker::tx_class(const struct can_frame& frame) {
+    switch (static_cast<charx::def::Command>(charx::get_command(frame.can_id))) {
+    case charx::def::Command::SWITCH_OPERATIONAL_READINESS:
+        return TxClass::SAFETY;
+    case charx::def::Command::SET_SYSTEM_OUTPUT_VOLTAGE_AND_CURRENT:
+    case charx::def::Command::SET_MODULE_OUTPUT_VOLTAGE_AND_CURRENT:
+        return TxClass::SETPOINT;
+    case charx::def::Command::SYSTEM_READ_ACTUAL_VALUES:
+    case charx::def::Command::SYSTEM_READ_MAX_VALUES:
+        return TxClass::SYSTEM_TELEMETRY;
+    case charx::def::Command::MODULE_READ_ACTUAL_VALUES:
+    case charx::def::Command::MODULE_READ_STATUS:
+        return TxClass::MODULE_STATUS;
+    default:
+        return TxClass::INFO;
+    }
+}
+
+// Send queued frames in bursts, frames the socket does not take now stay queued for the next round
+void CanBroker::flush_tx() {
+    if (uring) {
+        flush_tx_uring();
+        return;
+    }
+
+    // blocked writes wait for POLLOUT or the retry interval
+    if (tx_wait != TxWait::NONE) {
+        return;
+    }
+
+    std::array<TxEntry, TX_BATCH_SIZE> batch;
+    std::array<struct iovec, TX_BATCH_SIZE> iovecs;
+    std::array<struct mmsghdr, TX_BATCH_SIZE> msgs;
+
+    while (tx_wait == TxWait::NONE) {
+        std::size_t count = 0;
+        while (count < TX_BATCH_SIZE and take_tx(batch[count])) {
+            iovecs[count] = {&batch[count].frame, sizeof(struct can_frame)};
+            memset(&msgs[count], 0, sizeof(msgs[count]));
+            msgs[count].msg_hdr.msg_iov = &iovecs[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            ++count;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        const auto sent = sendmmsg(can_fd, msgs.data(), count, MSG_DONTWAIT);
+        std::size_t done = (sent > 0) ? sent : 0;
+
+        if (sent < 0) {
+            if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                tx_wait = TxWait::WRITABLE;
+            } else if (errno == ENOBUFS) {
+                // the interface queue is full, CAN sockets do not signal POLLOUT for this
+                tx_wait = TxWait::RETRY;
+                tx_retry_at = std::chrono::steady_clock::now() + TX_RETRY_INTERVAL;
+            } else if (errno != EINTR) {
+                // the frame cannot be sent at all, its request runs into the timeout
+                EVLOG_error << "Failed to write CAN frame: (" << strerror(errno) << ")";
+                done = 1;
+            }
+        }
+
+        // a short write puts the remaining frames back in front of their classes for the next round
+        for (auto index = count; index > done; --index) {
+            requeue_tx(std::move(batch[index - 1]));
+        }
+    }
+}
+
+// Queue the frames of issued requests, the loop flushes them as one burst. Requests whose frame does not fit are
+// completed as NOT_READY
+void CanBroker::send_requests(const std::vector<CanRequestPtr>& requests) {
+    std::vector<CanRequestPtr> issued;
+    std::vector<CanRequestPtr> done;
+
+    for (const auto& request : requests) {
+        if (not enqueue_tx(request) and request->state == CanRequest::State::ISSUED) {
+            request->state = CanRequest::State::NOT_READY;
+            release_slot(charx::request_key(request->frame), issued);
+            done.push_back(request);
+        }
+    }
+
+    if (not issued.empty()) {
+        send_requests(issued);
+    }
+    for (const auto& request : done) {
+        complete(request);
+    }
+}
+
+#ifndef CHARXPSM2_IO_URING
+// built without io_uring, the poll loop is used
+bool CanBroker::init_uring() {
+    return false;
+}
+
+void CanBroker::loop_uring() {
+}
+
+void CanBroker::flush_tx_uring() {
+}
+#endif
+
+void CanBroker::BlockingCall::finish(AccessReturnType result) {
+    status = result;
+    done.store(true, std::memory_order_release);
+    event.notify_all();
+}
+
+CanBroker::AccessReturnType CanBroker::BlockingCall::wait() {
+    while (true) {
+        const auto seen = event.sequence();
+        if (done.load(std::memory_order_acquire)) {
+            return status;
+        }
+        event.wait(seen);
+    }
+}
@@ -2,29 +2,24 @@
 #define Charx_PSM2_CAN_BROKER_HPP
 
 #include <array>
-#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
 
-#include"charxpsm2_protocol.hpp"
-
-struct CanRequest {
-    enum class State {
-        IDLE,
-        ISSUED,
-        COMPLETED,
-        FAILED,
-    } state{State::IDLE};
+#include <sys/socket.h>
 
-    uint32_t id; // identifier
-    uint32_t msg_type; // identifier but without error code
-    std::array<uint8_t, 8> response; // frame data
-    std::condition_variable cv;
-    std::mutex mutex;
-};
+#include"charxpsm2_protocol.hpp"
+#include "lock_free.hpp"
+#include "reactor.hpp"
+#include "rtt_estimator.hpp"
 
 class CanBroker {
 public:
@@ -35,35 +30,346 @@ public:
         NOT_READY,
     };
 
-    CanBroker(const std::string& interface_name);
+    // Completion callbacks of the *_async methods are invoked exactly once, from the broker thread.
+    // They must not call the blocking methods of the broker, that would stall the receive path.
+    using ResponseCallback = std::function<void(AccessReturnType status, uint64_t response)>;
+    using StatusCallback = std::function<void(AccessReturnType status)>;
+    using NumberOfModulesCallback = std::function<void(AccessReturnType status, uint8_t number_of_pwr_mdls)>;
+    using VoltageCurrentCallback = std::function<void(AccessReturnType status, float voltage, float current)>;
+    using ModuleStatusCallback = std::function<void(AccessReturnType status, const std::array<uint8_t, 5>& status_list)>;
+    using ModuleInfoCallback = std::function<void(AccessReturnType status, const std::array<uint8_t, 8>& info)>;
+
+    // Answer of one module to a broadcast request
+    struct ModuleResponse {
+        uint8_t module_address{0};
+        AccessReturnType status{AccessReturnType::TIMEOUT}; // TIMEOUT if the module did not answer in time
+        std::array<uint8_t, 8> data{};
+    };
+    // status is SUCCESS if every module answered without error, responses has one entry per expected module
+    using CollectCallback = std::function<void(AccessReturnType status, const std::vector<ModuleResponse>& responses)>;
+
+    struct ModuleStatus {
+        uint8_t module_address{0};
+        AccessReturnType status{AccessReturnType::TIMEOUT};
+        std::array<uint8_t, 5> status_list{};
+    };
+    using ModuleStatusesCallback =
+        std::function<void(AccessReturnType status, const std::vector<ModuleStatus>& statuses)>;
+
+    struct ModuleVoltageCurrent {
+        uint8_t module_address{0};
+        AccessReturnType status{AccessReturnType::TIMEOUT};
+        float voltage{0};
+        float current{0};
+    };
+    using ModuleVoltagesCurrentsCallback =
+        std::function<void(AccessReturnType status, const std::vector<ModuleVoltageCurrent>& values)>;
+
+    enum class IoBackend {
+        POLL,     // poll loop with recvmmsg/sendmmsg
+        IO_URING, // completion based, only available when built with CHARXPSM2_IO_URING
+    };
+
+    struct Config {
+        IoBackend io_backend{IoBackend::POLL};
+        // response timeouts adapt to the observed round trip times of each command and destination
+        RttEstimator::Config timeouts{};
+        // send a request once more when its p99 round trip time passed without response
+        bool hedged_retry{false};
+        // ceiling of the frames sent per second, reads wait above it while mode and setpoint frames still go
+        // out. 0 disables the ceiling.
+        double tx_ceiling_frames_per_s{0};
+    };
 
+    // Traffic classes of the TX scheduler, highest priority first. Frames of a class go out before any frame of
+    // the classes below it.
+    enum class TxClass : uint8_t {
+        SAFETY,           // operational readiness, switches the output on and off
+        SETPOINT,         // output voltage and current
+        SYSTEM_TELEMETRY, // broadcast reads of the system values
+        MODULE_STATUS,    // reads of a single module
+        INFO,             // module info and diagnostics
+    };
+    constexpr static std::size_t TX_CLASS_COUNT = 5;
+
+    // runs its own loop thread
+    CanBroker(const std::string& interface_name, const Config& config);
+    // runs on the thread of the reactor, which has to outlive the broker. Always uses the poll style socket I/O.
+    CanBroker(const std::string& interface_name, const Config& config, Reactor& reactor);
+
+    // blocking access, waits for the response or timeout
     void set_state(bool enabled);
     void read_number_of_modules(bool& power_modules_connected, uint8_t& actual_number_of_pwr_mdls);
     CanBroker::AccessReturnType set_system_voltage_current(const float& voltage, const float& current);
     CanBroker::AccessReturnType read_system_voltage_current(float& voltage, float& current);
     CanBroker::AccessReturnType read_power_module_status(uint8_t module_address, std::array<uint8_t, 5>& status_list);
 
+    // non-blocking access, returns as soon as the request is queued
+    void set_state_async(bool enabled, StatusCallback callback);
+    void read_number_of_modules_async(NumberOfModulesCallback callback);
+    void set_system_voltage_current_async(float voltage, float current, StatusCallback callback);
+    void read_system_voltage_current_async(VoltageCurrentCallback callback);
+    void read_power_module_status_async(uint8_t module_address, ModuleStatusCallback callback);
+    void read_module_info_async(uint8_t module_address, ModuleInfoCallback callback);
+    // readiness and output of a single module, for module staging
+    void set_module_state_async(uint8_t module_address, bool enabled, StatusCallback callback);
+    void set_module_voltage_current_async(uint8_t module_address, float voltage, float current,
+                                          StatusCallback callback);
+    // one broadcast for the status of all listed modules instead of a request per module
+    void read_power_module_statuses_async(const std::vector<uint8_t>& module_addresses,
+                                          ModuleStatusesCallback callback);
+    // actual output voltage and current of each listed module, one broadcast as well
+    void read_module_voltages_currents_async(const std::vector<uint8_t>& module_addresses,
+                                             ModuleVoltagesCurrentsCallback callback);
+
+    // Commands to a module group, completed once all listed member modules answered
+    void set_group_state_async(uint8_t group, const std::vector<uint8_t>& module_addresses, bool enabled,
+                               StatusCallback callback);
+    void set_group_voltage_current_async(uint8_t group, const std::vector<uint8_t>& module_addresses, float voltage,
+                                         float current, StatusCallback callback);
+    void read_group_voltages_currents_async(uint8_t group, const std::vector<uint8_t>& module_addresses,
+                                            ModuleVoltagesCurrentsCallback callback);
+
+    // A response as it came off the bus, timestamp in CLOCK_REALTIME (kernel software timestamp if available)
+    struct ReceivedFrame {
+        std::chrono::nanoseconds timestamp{0};
+        uint8_t command{0};
+        uint8_t source{0};
+        can::protocol::charxpsm2::def::ErrorCode error_code{can::protocol::charxpsm2::def::ErrorCode::NORMAL};
+        std::array<uint8_t, 8> data{};
+    };
+
+    // Hand the responses received since the last call to handler, returns their number. Only one thread may drain.
+    // Frames the consumer did not pick up in time are dropped and counted in get_rx_overruns().
+    std::size_t drain_received(const std::function<void(const ReceivedFrame&)>& handler);
+    uint64_t get_rx_overruns() const;
+
+    // Request to response latencies of one command, taken from kernel timestamps
+    struct LatencyStatistics {
+        uint64_t samples{0};
+        std::chrono::microseconds bus_min{0};     // TX confirmation to response, time on the bus and in the module
+        std::chrono::microseconds bus_max{0};
+        std::chrono::microseconds bus_avg{0};
+        std::chrono::microseconds tx_delay_avg{0}; // queued to TX confirmation, socket and interface queues
+        std::chrono::microseconds tx_delay_max{0};
+        std::chrono::microseconds wakeup_avg{0};   // response reception to completion, thread wakeup
+        std::chrono::microseconds wakeup_max{0};
+        std::chrono::milliseconds timeout{0};      // current response timeout of the command
+        uint64_t hedged_retries{0};
+    };
+
+    // statistics keyed by command number, a snapshot the broker thread refreshes when it is idle
+    std::map<uint8_t, LatencyStatistics> get_latency_statistics();
+
+    // Frames of one traffic class
+    struct TxStatistics {
+        uint64_t sent{0};
+        uint64_t dropped_stale{0}; // request finished before its frame went out, e.g. timed out in the queue
+        uint64_t coalesced{0};     // reads answered by an identical request already queued or on the bus
+        uint64_t rejected{0};      // refused while the TX queue or socket was full
+        uint64_t throttled{0};     // times the class was held back by the TX ceiling
+    };
+
+    // same snapshot as get_latency_statistics(), indexed by TxClass
+    std::array<TxStatistics, TX_CLASS_COUNT> get_tx_statistics();
+
     ~CanBroker();
 
 private:
-    constexpr static auto ACCESS_TIMEOUT = std::chrono::milliseconds(200);
+    constexpr static std::size_t RX_BATCH_SIZE = 32;    // frames drained per recvmmsg
+    constexpr static std::size_t TX_BATCH_SIZE = 32;    // frames flushed per sendmmsg
+    constexpr static std::size_t TX_QUEUE_LIMIT = 256;  // frames waiting for socket buffer space
+    constexpr static std::size_t TX_READ_LIMIT = 128;   // share of the TX queue reads may fill
+    constexpr static auto TX_CEILING_BURST = std::chrono::milliseconds(20); // frames of this time may go at once
+    constexpr static auto TX_RETRY_INTERVAL = std::chrono::milliseconds(2); // retry after ENOBUFS
+    constexpr static std::size_t RX_RING_SIZE = 256;    // received frames not yet drained by the consumer
+
+    enum class TxWait {
+        NONE,
+        WRITABLE, // socket buffer full, wait for POLLOUT
+        RETRY,    // device queue full (ENOBUFS), retry after TX_RETRY_INTERVAL
+    };
+
+    struct CanRequest {
+        enum class State {
+            QUEUED,
+            ISSUED,
+            COMPLETED,
+            FAILED,
+            TIMEOUT,
+            NOT_READY,
+        } state{State::QUEUED};
+
+        struct can_frame frame; // issued frame
+        std::array<uint8_t, 8> response{}; // frame data
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::steady_clock::time_point retry_at{std::chrono::steady_clock::time_point::max()};
+        bool hedged{false}; // sent twice, the second answer may still come after it completed
+        ResponseCallback on_completion;
+        TxClass tx_class{TxClass::INFO};
+
+        // Broadcast collecting the answers of several modules, it completes once all answered or at the deadline
+        std::vector<ModuleResponse> collected; // one entry per expected module, empty for ordinary requests
+        std::size_t answered{0};
+        CollectCallback on_collected;
+
+        // CLOCK_REALTIME, zero if unknown
+        std::chrono::nanoseconds queued_at{0};
+        std::chrono::nanoseconds tx_confirmed_at{0};
+        std::chrono::nanoseconds tx_confirmed_hw_at{0};
+
+        std::atomic<CanRequest*> next_node{nullptr}; // link in the submission queue
+    };
+    using CanRequestPtr = std::shared_ptr<CanRequest>;
+
+    // a frame waiting in the TX queue of its class, dropped if its request finished meanwhile
+    struct TxEntry {
+        struct can_frame frame;
+        CanRequestPtr request;
+    };
+
+    // Completion of a blocking call, the waiter sleeps on a futex instead of a mutex the broker thread would take
+    struct BlockingCall {
+        AccessReturnType status{AccessReturnType::FAILED};
+        std::atomic<bool> done{false};
+        FutexEvent event;
+
+        void finish(AccessReturnType result);
+        AccessReturnType wait();
+    };
+
+    // metadata of a received frame, timestamps in CLOCK_REALTIME (software) or the interface clock (hardware)
+    struct RxInfo {
+        bool echo{false}; // loopback of our own frame after it was sent
+        std::chrono::nanoseconds software_timestamp{0};
+        std::chrono::nanoseconds hardware_timestamp{0};
+    };
+
+    struct LatencySums {
+        uint64_t samples{0};
+        uint64_t bus_samples{0};
+        std::chrono::nanoseconds bus_min{std::chrono::nanoseconds::max()};
+        std::chrono::nanoseconds bus_max{0};
+        std::chrono::nanoseconds bus_sum{0};
+        std::chrono::nanoseconds tx_delay_max{0};
+        std::chrono::nanoseconds tx_delay_sum{0};
+        std::chrono::nanoseconds wakeup_max{0};
+        std::chrono::nanoseconds wakeup_sum{0};
+        uint64_t hedged_retries{0};
+    };
+
+    // space for SCM_TIMESTAMPING
+    constexpr static std::size_t RX_CONTROL_SIZE = 128;
+
+    CanBroker(const std::string& interface_name, const Config& config, Reactor* reactor);
+    void attach_reactor();
+    bool service_reactor();
 
     void loop();
-    void write_to_can(const struct can_frame& frame);
-    AccessReturnType dispatch_frame(const struct can_frame& frame, uint64_t* response = nullptr);
-    uint32_t invert_src_dst(uint32_t can_id);
-    void handle_can_input(can_frame& frame);
-    uint32_t get_msg_type(uint32_t identifier);
-    void handle_errors(uint32_t can_id);
+    void service();
+    std::chrono::steady_clock::time_point next_deadline();
+    int next_timeout_ms();
+    void handle_deadlines();
+    bool accept_submissions();
+    void publish_statistics();
+    void fail_outstanding_requests();
+    void read_from_can();
+    bool enqueue_tx(const CanRequestPtr& request);
+    bool take_tx(TxEntry& entry);
+    void requeue_tx(TxEntry&& entry);
+    bool coalesce(const CanRequestPtr& request);
+    void refill_tx_tokens(std::chrono::steady_clock::time_point now);
+    static TxClass tx_class(const struct can_frame& frame);
+    void flush_tx();
+    void send_requests(const std::vector<CanRequestPtr>& requests);
+    bool install_filters();
+    void dispatch_frame_async(const struct can_frame& frame, ResponseCallback callback);
+    void collect_frame_async(const struct can_frame& frame, const std::vector<uint8_t>& module_addresses,
+                             CollectCallback callback);
+    void collect_voltages_currents_async(const struct can_frame& frame, const std::vector<uint8_t>& module_addresses,
+                                         ModuleVoltagesCurrentsCallback callback);
+    void submit(CanRequest* request);
+    bool collect_response(const CanRequestPtr& request, const can_frame& frame);
+    void handle_can_input(can_frame& frame, const RxInfo& info);
+    void record_latency(const CanRequest& request, const RxInfo& info);
+    static RxInfo parse_rx_info(const struct msghdr& msg);
+    void prepare_rx_msg(std::size_t index);
+    bool handle_errors(uint32_t can_id);
+
+    CanRequestPtr find_request(const can_frame& frame);
+    static bool awaits_answer(const CanRequest& request, uint8_t source);
+    void absorb_hedged_answer(const can_frame& frame);
+
+    // the following helpers run on the broker thread only, finished requests are collected in done
+    void release_slot(uint16_t key, std::vector<CanRequestPtr>& issued);
+    void issue(CanRequest& request);
+    void record_rtt(const CanRequest& request, const RxInfo& info);
+    void record_timeout(const CanRequest& request);
+    void expire_requests(std::vector<CanRequestPtr>& done, std::vector<CanRequestPtr>& issued);
+
+    // io_uring backend (can_broker_uring.cpp)
+    struct Uring;
+    bool init_uring();
+    void loop_uring();
+    void flush_tx_uring();
+
+    void complete(const CanRequestPtr& request);
+    static AccessReturnType to_access_return_type(CanRequest::State state);
+    void wakeup_loop();
 
     uint8_t device_src;
     uint8_t broadcast_adr{0x3F};
-    std::mutex access_mtx;
-    CanRequest request;
+
+    // Requests are handed over through the submission queue, everything below up to the statistics snapshot
+    // belongs to the broker thread and is accessed without locks
+    MpscQueue<CanRequest> submissions;
+    std::map<uint16_t, CanRequestPtr> pending_requests; // on the bus, one per key
+    std::deque<CanRequestPtr> queued_requests;          // waiting for their key to become free
     const uint8_t monitor_id{0xf0};
     std::thread loop_thread;
+    std::atomic<bool> exit_requested{false};
+
+    std::array<struct can_frame, RX_BATCH_SIZE> rx_frames;
+    std::array<struct iovec, RX_BATCH_SIZE> rx_iovecs;
+    std::array<struct mmsghdr, RX_BATCH_SIZE> rx_msgs;
+    std::array<std::array<uint64_t, RX_CONTROL_SIZE / sizeof(uint64_t)>, RX_BATCH_SIZE> rx_controls; // cmsg aligned
+
+    std::map<uint8_t, LatencySums> latencies;
+    uint64_t completed_requests{0};
+
+    const Config config;
+    std::map<uint16_t, RttEstimator> rtt_per_request_key;
+    std::map<uint8_t, RttEstimator> rtt_per_command;        // fallback for destinations without history
+
+    std::array<std::deque<TxEntry>, TX_CLASS_COUNT> tx_queues;
+    std::size_t tx_queued{0};
+    TxWait tx_wait{TxWait::NONE};
+    std::chrono::steady_clock::time_point tx_retry_at;
+    std::array<TxStatistics, TX_CLASS_COUNT> tx_statistics;
+
+    // token bucket of the TX ceiling, only reads wait for tokens
+    double tx_tokens{0};
+    std::chrono::steady_clock::time_point tx_tokens_at;
+    std::chrono::steady_clock::time_point tx_throttled_until{std::chrono::steady_clock::time_point::min()};
+
+    // responses for the consumer, the broker thread is the only producer
+    SpscRing<ReceivedFrame, RX_RING_SIZE> received_frames;
+    std::atomic<uint64_t> rx_overruns{0};
+
+    // the broker thread only try_locks, it never waits for a reader of the snapshot
+    std::mutex statistics_mtx;
+    std::map<uint8_t, LatencyStatistics> statistics_snapshot;
+    std::array<TxStatistics, TX_CLASS_COUNT> tx_statistics_snapshot;
+    bool statistics_changed{false};
+
+    std::unique_ptr<Uring> uring; // set if the io_uring backend is in use
+
+    Reactor* reactor{nullptr};    // set if the broker runs on a reactor instead of loop_thread
+    std::unique_ptr<TimerFd> deadline_timer;
+    std::chrono::steady_clock::time_point armed_deadline{std::chrono::steady_clock::time_point::max()};
+    uint32_t can_events{EPOLLIN};
     int event_fd{-1};
     int can_fd{-1};
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,190 @@
+#include "can_broker.hpp"
+#include "can_broker_uring.hpp"
+
+#include <cstring>
+
+#include <everest/logging.hpp>
+
+namespace {
+// Ring entries for the posted reads, the event read and the frames in flight
+constexpr unsigned RING_ENTRIES = 128;
+
+// user data of a submission: operation and buffer index
+enum class Operation : uintptr_t {
+    RX = 1,
+    EVENT = 2,
+    TX = 3,
+};
+
+void* make_user_data(Operation operation, std::size_t index) {
+    return reinterpret_cast<void*>((static_cast<uintptr_t>(operation) << 16) | index);
+}
+
+Operation get_operation(void* user_data) {
+    return static_cast<Operation>(reinterpret_cast<uintptr_t>(user_data) >> 16);
+}
+
+std::size_t get_index(void* user_data) {
+    return reinterpret_cast<uintptr_t>(user_data) & 0xFFFF;
+}
+} // namespace
+
+bool CanBroker::init_uring() {
+    auto backend = std::make_unique<Uring>();
+
+    const auto result = io_uring_queue_init(RING_ENTRIES, &backend->ring, 0);
+    if (result < 0) {
+        EVLOG_warning << "Failed with io_uring_queue_init: (" << strerror(-result) << ")";
+        return false;
+    }
+    backend->initialized = true;
+
+    uring = std::move(backend);
+    return true;
+}
+
+// Completion loop: reads on can_fd and event_fd stay posted, submitted requests are sent through the ring by
+// flush_tx_uring
+void CanBroker::loop_uring() {
+    auto& ring = uring->ring;
+
+    const auto post_rx = [&](std::size_t index) {
+        prepare_rx_msg(index);
+        auto* sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_recvmsg(sqe, can_fd, &rx_msgs[index].msg_hdr, 0);
+        io_uring_sqe_set_data(sqe, make_user_data(Operation::RX, index));
+    };
+    const auto post_event = [&]() {
+        auto* sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_read(sqe, event_fd, &uring->event_value, sizeof(uring->event_value), 0);
+        io_uring_sqe_set_data(sqe, make_user_data(Operation::EVENT, 0));
+    };
+
+    for (std::size_t i = 0; i < RX_BATCH_SIZE; ++i) {
+        post_rx(i);
+    }
+    post_event();
+    io_uring_submit(&ring);
+
+    std::vector<std::size_t> rx_done;
+    rx_done.reserve(RX_BATCH_SIZE);
+
+    while (true) {
+        const int timeout_ms = next_timeout_ms();
+
+        struct io_uring_cqe* cqe = nullptr;
+        int result;
+        if (timeout_ms < 0) {
+            result = io_uring_wait_cqe(&ring, &cqe);
+        } else {
+            struct __kernel_timespec timeout {};
+            timeout.tv_sec = timeout_ms / 1000;
+            timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            result = io_uring_wait_cqe_timeout(&ring, &cqe, &timeout);
+        }
+
+        if (result < 0 and result != -ETIME and result != -EINTR) {
+            EVLOG_error << "Failed to wait for io_uring completion: (" << strerror(-result) << ")";
+        }
+
+        // handle every completion that is available
+        bool event_done = false;
+        rx_done.clear();
+
+        while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+            void* user_data = io_uring_cqe_get_data(cqe);
+            const auto res = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+
+            const auto index = get_index(user_data);
+            switch (get_operation(user_data)) {
+            case Operation::RX:
+                if (res == sizeof(struct can_frame)) {
+                    handle_can_input(rx_frames[index], parse_rx_info(rx_msgs[index].msg_hdr));
+                } else if (res < 0 and res != -EINTR) {
+                    EVLOG_error << "Failed to read CAN frame: (" << strerror(-res) << ")";
+                }
+                rx_done.push_back(index);
+                break;
+
+            case Operation::EVENT:
+                // new event, either new requests or the exit request
+                if (exit_requested) {
+                    return;
+                }
+                event_done = true;
+                break;
+
+            case Operation::TX: {
+                auto& slot = uring->tx_slots[index];
+                if (res == -EAGAIN or res == -ENOBUFS) {
+                    // the interface queue is full, send the frame again after TX_RETRY_INTERVAL
+                    requeue_tx(std::move(slot.entry));
+                    tx_wait = TxWait::RETRY;
+                    tx_retry_at = std::chrono::steady_clock::now() + TX_RETRY_INTERVAL;
+                } else if (res < 0) {
+                    // the frame cannot be sent at all, its request runs into the timeout
+                    EVLOG_error << "Failed to write CAN frame: (" << strerror(-res) << ")";
+                }
+                slot.entry.request.reset();
+                slot.busy = false;
+                break;
+            }
+            }
+        }
+
+        // keep the reads posted
+        if (not rx_done.empty() or event_done) {
+            for (const auto index : rx_done) {
+                post_rx(index);
+            }
+            if (event_done) {
+                post_event();
+            }
+            io_uring_submit(&ring);
+        }
+
+        // new requests and frames waiting for a free slot
+        service();
+    }
+}
+
+// Submit queued frames without waiting for their completion, at most TX_BATCH_SIZE are in flight
+void CanBroker::flush_tx_uring() {
+    // frames after ENOBUFS wait for the retry interval
+    if (tx_wait != TxWait::NONE) {
+        return;
+    }
+
+    unsigned submitted = 0;
+
+    for (std::size_t index = 0; index < uring->tx_slots.size(); ++index) {
+        auto& slot = uring->tx_slots[index];
+        if (slot.busy) {
+            continue;
+        }
+
+        if (not take_tx(slot.entry)) {
+            break;
+        }
+        auto* sqe = io_uring_get_sqe(&uring->ring);
+        if (not sqe) {
+            requeue_tx(std::move(slot.entry));
+            break;
+        }
+
+        slot.iovec = {&slot.entry.frame, sizeof(slot.entry.frame)};
+        memset(&slot.msg, 0, sizeof(slot.msg));
+        slot.msg.msg_iov = &slot.iovec;
+        slot.msg.msg_iovlen = 1;
+        slot.busy = true;
+
+        io_uring_prep_sendmsg(sqe, can_fd, &slot.msg, 0);
+        io_uring_sqe_set_data(sqe, make_user_data(Operation::TX, index));
+        ++submitted;
+    }
+
+    if (submitted > 0) {
+        io_uring_submit(&uring->ring);
+    }
+}
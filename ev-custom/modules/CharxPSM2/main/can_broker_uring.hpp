@@ -0,0 +1,39 @@
+#ifndef Charx_PSM2_CAN_BROKER_URING_HPP
+#define Charx_PSM2_CAN_BROKER_URING_HPP
+
+// State of the io_uring CAN backend, private to the CanBroker translation units
+
+#include "can_broker.hpp"
+
+#ifdef CHARXPSM2_IO_URING
+
+#include <liburing.h>
+
+struct CanBroker::Uring {
+    // a frame in flight, the buffers have to live until its completion
+    struct TxSlot {
+        TxEntry entry;
+        struct iovec iovec;
+        struct msghdr msg;
+        bool busy{false};
+    };
+
+    ~Uring() {
+        if (initialized) {
+            io_uring_queue_exit(&ring);
+        }
+    }
+
+    struct io_uring ring;
+    bool initialized{false}; // the ring belongs to the loop thread, submissions and completions alike
+    std::array<TxSlot, TX_BATCH_SIZE> tx_slots;
+    uint64_t event_value{0};
+};
+
+#else
+
+struct CanBroker::Uring {};
+
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+#include "can_sequence.hpp"
+
+#include <memory>
+
+#include <everest/logging.hpp>
+
+CanTask::~CanTask() {
+    if (task) {
+        task.destroy();
+    }
+}
+
+bool CanTask::done() const {
+    return not task or task.done();
+}
+
+void CanTask::await_resume() {
+    if (task.promise().exception) {
+        std::rethrow_exception(task.promise().exception);
+    }
+}
+
+SequenceExecutor::~SequenceExecutor() {
+    while (auto* item = posted.pop()) {
+        delete item;
+    }
+}
+
+void SequenceExecutor::post(std::function<void()> new_work) {
+    posted.push(new WorkItem{std::move(new_work)});
+
+    if (not reactor) {
+        posted_event.notify_all();
+    } else if (not reactor->in_reactor_thread()) {
+        reactor->wake();
+    }
+}
+
+void SequenceExecutor::post_at(Clock::time_point time, std::function<void()> new_work) {
+    timers.emplace(time, std::move(new_work));
+}
+
+void SequenceExecutor::spawn(CanTask new_task) {
+    auto& task = tasks.emplace_back(std::move(new_task));
+    // the sequence runs until its first co_await within run()
+    post([handle = task.task]() { handle.resume(); });
+}
+
+void SequenceExecutor::run() {
+    while (not tasks.empty()) {
+        // read before looking at the queue, a post in between makes the wait below return at once
+        const auto seen = posted_event.sequence();
+
+        if (auto* item = posted.pop()) {
+            const std::unique_ptr<WorkItem> next(item);
+            next->work();
+            reap_finished_tasks();
+            continue;
+        }
+
+        // posted work goes first, timers run once the queue is empty
+        if (not timers.empty() and timers.begin()->first <= Clock::now()) {
+            auto next = std::move(timers.begin()->second);
+            timers.erase(timers.begin());
+            next();
+            reap_finished_tasks();
+            continue;
+        }
+
+        if (timers.empty()) {
+            posted_event.wait(seen);
+        } else {
+            posted_event.wait_until(seen, timers.begin()->first);
+        }
+    }
+}
+
+void SequenceExecutor::attach(Reactor& new_reactor) {
+    reactor = &new_reactor;
+    timer = std::make_unique<TimerFd>();
+
+    reactor->watch(timer->get_fd(), EPOLLIN, [this](uint32_t) { timer->read_expirations(); });
+    reactor->add_round_hook([this]() { return run_ready(); });
+}
+
+// Round hook of the reactor: posted work and due timers, returns true if anything ran
+bool SequenceExecutor::run_ready() {
+    bool busy = false;
+
+    while (auto* item = posted.pop()) {
+        const std::unique_ptr<WorkItem> next(item);
+        next->work();
+        reap_finished_tasks();
+        busy = true;
+    }
+
+    const auto now = Clock::now();
+    while (not timers.empty() and timers.begin()->first <= now) {
+        auto next = std::move(timers.begin()->second);
+        timers.erase(timers.begin());
+        next();
+        reap_finished_tasks();
+        busy = true;
+    }
+
+    if (tasks.empty()) {
+        reactor->stop();
+    }
+
+    const auto next_timer = timers.empty() ? Clock::time_point::max() : timers.begin()->first;
+    if (next_timer != armed_timer) {
+        armed_timer = next_timer;
+        timer->arm_at(next_timer);
+    }
+
+    return busy;
+}
+
+void SequenceExecutor::reap_finished_tasks() {
+    for (auto it = tasks.begin(); it != tasks.end();) {
+        if (not it->done()) {
+            ++it;
+            continue;
+        }
+
+        try {
+            it->await_resume();
+        } catch (const std::exception& e) {
+            EVLOG_error << "CAN sequence failed: " << e.what();
+        }
+        it = tasks.erase(it);
+    }
+}
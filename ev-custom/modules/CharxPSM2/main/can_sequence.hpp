@@ -0,0 +1,307 @@
+#ifndef Charx_PSM2_CAN_SEQUENCE_HPP
+#define Charx_PSM2_CAN_SEQUENCE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include "can_broker.hpp"
+#include "lock_free.hpp"
+#include "reactor.hpp"
+
+// Coroutine front-end for CanBroker. Multi-step command sequences are written as CanTask coroutines
+// which suspend on CAN responses (or their timeouts) and get resumed by a SequenceExecutor, so any
+// number of sequences share the one thread that runs the executor.
+
+class CanTask {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+
+        CanTask get_return_object() {
+            return CanTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        auto final_suspend() noexcept {
+            // hand over to the awaiting coroutine, if there is one
+            struct FinalAwaiter {
+                bool await_ready() noexcept {
+                    return false;
+                }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> task) noexcept {
+                    const auto continuation = task.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+                void await_resume() noexcept {
+                }
+            };
+            return FinalAwaiter{};
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            exception = std::current_exception();
+        }
+    };
+
+    CanTask(CanTask&& other) noexcept : task(std::exchange(other.task, nullptr)){};
+    CanTask(const CanTask&) = delete;
+    CanTask& operator=(const CanTask&) = delete;
+    ~CanTask();
+
+    bool done() const;
+
+    // awaiting a task starts it, the awaiting coroutine continues when the task finished
+    bool await_ready() const noexcept {
+        return not task or task.done();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        task.promise().continuation = awaiting;
+        return task;
+    }
+    void await_resume();
+
+private:
+    friend class SequenceExecutor;
+    explicit CanTask(std::coroutine_handle<promise_type> task) : task(task){};
+
+    std::coroutine_handle<promise_type> task;
+};
+
+class SequenceExecutor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    SequenceExecutor() = default;
+    SequenceExecutor(const SequenceExecutor&) = delete;
+    SequenceExecutor& operator=(const SequenceExecutor&) = delete;
+    ~SequenceExecutor();
+
+    // Thread safe and lock free, the CAN broker thread posts completions here. The work runs on the thread inside run()
+    void post(std::function<void()> work);
+
+    // Call before run() or from within a sequence, timers belong to the executor thread
+    void post_at(Clock::time_point time, std::function<void()> work);
+
+    // Start a top-level sequence, the executor owns it until it finished.
+    // Call before run() or from within a sequence, spawning is not thread safe.
+    void spawn(CanTask task);
+
+    // Run posted work until all spawned sequences finished
+    void run();
+
+    // Alternative to run(): the work runs on the thread of the reactor, which is stopped once all spawned
+    // sequences finished. Sleeping sequences wake up through a timerfd.
+    void attach(Reactor& reactor);
+
+    struct SleepAwaiter {
+        SequenceExecutor& executor;
+        Clock::time_point wakeup;
+
+        bool await_ready() const noexcept {
+            return Clock::now() >= wakeup;
+        }
+        void await_suspend(std::coroutine_handle<> sequence) {
+            executor.post_at(wakeup, [sequence]() { sequence.resume(); });
+        }
+        void await_resume() const noexcept {
+        }
+    };
+
+    // awaitable: resume the sequence after the given time
+    SleepAwaiter sleep_for(Clock::duration duration) {
+        return sleep_until(Clock::now() + duration);
+    }
+
+    // awaitable: resume the sequence at an absolute time, for periodic work without drift
+    SleepAwaiter sleep_until(Clock::time_point wakeup) {
+        return SleepAwaiter{*this, wakeup};
+    }
+
+private:
+    struct WorkItem {
+        std::function<void()> work;
+        std::atomic<WorkItem*> next_node{nullptr};
+    };
+
+    void reap_finished_tasks();
+    bool run_ready();
+
+    MpscQueue<WorkItem> posted;
+    FutexEvent posted_event;
+    std::multimap<Clock::time_point, std::function<void()>> timers;
+    std::list<CanTask> tasks;
+
+    Reactor* reactor{nullptr};
+    std::unique_ptr<TimerFd> timer;
+    Clock::time_point armed_timer{Clock::time_point::max()};
+};
+
+template <typename T> struct CanResult {
+    CanBroker::AccessReturnType status;
+    T value;
+};
+
+struct VoltageCurrent {
+    float voltage;
+    float current;
+};
+
+// Awaitable wrappers for the asynchronous CanBroker API, the awaiting sequence is resumed on the executor
+class CanSequence {
+public:
+    CanSequence(CanBroker& broker, SequenceExecutor& executor) : broker(broker), executor(executor){};
+
+    // co_await yields CanBroker::AccessReturnType
+    auto set_state(bool enabled) {
+        return make_operation<CanBroker::AccessReturnType>([this, enabled](auto done) {
+            broker.set_state_async(enabled, std::move(done));
+        });
+    }
+
+    auto set_system_voltage_current(float voltage, float current) {
+        return make_operation<CanBroker::AccessReturnType>([this, voltage, current](auto done) {
+            broker.set_system_voltage_current_async(voltage, current, std::move(done));
+        });
+    }
+
+    // co_await yields CanResult with the requested data
+    auto read_number_of_modules() {
+        return make_operation<CanResult<uint8_t>>([this](auto done) {
+            broker.read_number_of_modules_async(
+                [done](CanBroker::AccessReturnType status, uint8_t number) { done({status, number}); });
+        });
+    }
+
+    auto read_system_voltage_current() {
+        return make_operation<CanResult<VoltageCurrent>>([this](auto done) {
+            broker.read_system_voltage_current_async([done](CanBroker::AccessReturnType status, float voltage,
+                                                            float current) { done({status, {voltage, current}}); });
+        });
+    }
+
+    auto read_power_module_status(uint8_t module_address) {
+        return make_operation<CanResult<std::array<uint8_t, 5>>>([this, module_address](auto done) {
+            broker.read_power_module_status_async(
+                module_address, [done](CanBroker::AccessReturnType status, const std::array<uint8_t, 5>& status_list) {
+                    done({status, status_list});
+                });
+        });
+    }
+
+    // one broadcast, a status per module, TIMEOUT for the modules which did not answer
+    auto read_power_module_statuses(const std::vector<uint8_t>& module_addresses) {
+        return make_operation<CanResult<std::vector<CanBroker::ModuleStatus>>>([this, module_addresses](auto done) {
+            broker.read_power_module_statuses_async(
+                module_addresses,
+                [done](CanBroker::AccessReturnType status, const std::vector<CanBroker::ModuleStatus>& statuses) {
+                    done({status, statuses});
+                });
+        });
+    }
+
+    auto read_module_voltages_currents(const std::vector<uint8_t>& module_addresses) {
+        return make_operation<CanResult<std::vector<CanBroker::ModuleVoltageCurrent>>>(
+            [this, module_addresses](auto done) {
+                broker.read_module_voltages_currents_async(
+                    module_addresses, [done](CanBroker::AccessReturnType status,
+                                             const std::vector<CanBroker::ModuleVoltageCurrent>& values) {
+                        done({status, values});
+                    });
+            });
+    }
+
+    auto set_module_state(uint8_t module_address, bool enabled) {
+        return make_operation<CanBroker::AccessReturnType>([this, module_address, enabled](auto done) {
+            broker.set_module_state_async(module_address, enabled, std::move(done));
+        });
+    }
+
+    auto set_module_voltage_current(uint8_t module_address, float voltage, float current) {
+        return make_operation<CanBroker::AccessReturnType>([this, module_address, voltage, current](auto done) {
+            broker.set_module_voltage_current_async(module_address, voltage, current, std::move(done));
+        });
+    }
+
+    // commands to a module group, the answers of the listed members are collected
+    auto set_group_state(uint8_t group, const std::vector<uint8_t>& module_addresses, bool enabled) {
+        return make_operation<CanBroker::AccessReturnType>([this, group, module_addresses, enabled](auto done) {
+            broker.set_group_state_async(group, module_addresses, enabled, std::move(done));
+        });
+    }
+
+    auto set_group_voltage_current(uint8_t group, const std::vector<uint8_t>& module_addresses, float voltage,
+                                   float current) {
+        return make_operation<CanBroker::AccessReturnType>(
+            [this, group, module_addresses, voltage, current](auto done) {
+                broker.set_group_voltage_current_async(group, module_addresses, voltage, current, std::move(done));
+            });
+    }
+
+    auto read_group_voltages_currents(uint8_t group, const std::vector<uint8_t>& module_addresses) {
+        return make_operation<CanResult<std::vector<CanBroker::ModuleVoltageCurrent>>>(
+            [this, group, module_addresses](auto done) {
+                broker.read_group_voltages_currents_async(
+                    group, module_addresses,
+                    [done](CanBroker::AccessReturnType status,
+                           const std::vector<CanBroker::ModuleVoltageCurrent>& values) { done({status, values}); });
+            });
+    }
+
+    auto read_module_info(uint8_t module_address) {
+        return make_operation<CanResult<std::array<uint8_t, 8>>>([this, module_address](auto done) {
+            broker.read_module_info_async(
+                module_address, [done](CanBroker::AccessReturnType status, const std::array<uint8_t, 8>& info) {
+                    done({status, info});
+                });
+        });
+    }
+
+    SequenceExecutor& get_executor() {
+        return executor;
+    }
+
+private:
+    // Suspends the sequence, starts the request and resumes with its result once the broker completed it
+    template <typename Result> struct Operation {
+        using Done = std::function<void(Result)>;
+
+        SequenceExecutor& executor;
+        std::function<void(Done)> start;
+        std::optional<Result> result;
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> sequence) {
+            start([this, sequence](Result value) {
+                executor.post([this, sequence, value = std::move(value)]() {
+                    result = std::move(value);
+                    sequence.resume();
+                });
+            });
+        }
+        Result await_resume() {
+            return std::move(*result);
+        }
+    };
+
+    template <typename Result> Operation<Result> make_operation(std::function<void(typename Operation<Result>::Done)> start) {
+        return Operation<Result>{executor, std::move(start), std::nullopt};
+    }
+
+    CanBroker& broker;
+    SequenceExecutor& executor;
+};
+
+#endif
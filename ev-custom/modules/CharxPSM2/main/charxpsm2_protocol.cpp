@@ -25,9 +25,14 @@ void prepare_frame(can_frame& frame, uint8_t source, uint8_t destination, def::C
     std::memcpy(frame.data, input_data.data(), std::min(input_data.size(), size_t(8)));
 };
 
-void set_header(struct can_frame& frame, uint8_t source, uint8_t destination, def::Command commandNo) {
+void prepare_group_frame(struct can_frame& frame, uint8_t source, uint8_t group, def::Command commandNo,
+                         const std::vector<uint8_t>& data) {
+    prepare_frame(frame, source, group, commandNo, data);
+    set_header(frame, source, group, commandNo, def::DEVICE_NO_GROUP);
+}
+
+void set_header(struct can_frame& frame, uint8_t source, uint8_t destination, def::Command commandNo, uint8_t deviceNo) {
     def::ErrorCode errorCode = def::ErrorCode::NORMAL;
-    const uint8_t deviceNo = 0x0A;
 
     frame.can_id = (static_cast<uint8_t>(errorCode) << def::ERROR_CODE_BIT_SHIFT) |
          (deviceNo << def::DEVICE_NO_BIT_SHIFT) |
@@ -63,6 +68,58 @@ void parse_statuses(std::array<uint8_t, 5>& status_list, uint64_t& response) {
     status_list[3] = response & 0xFF ;           // status 1
 }
 
+std::vector<struct can_filter> response_filters(uint8_t monitor_id) {
+    // error code and command number are not filtered, error responses have to get through
+    const canid_t response_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | (0x0Fu << def::DEVICE_NO_BIT_SHIFT) |
+                                  (0xFFu << def::TARGET_ADDR_BIT_SHIFT);
+
+    // the modules answer group commands from their own address, the device number may stay the one of the
+    // group command, so both are let through
+    std::vector<struct can_filter> filters;
+    for (const auto device_no : {def::DEVICE_NO, def::DEVICE_NO_GROUP}) {
+        const canid_t response_id = CAN_EFF_FLAG | (static_cast<canid_t>(device_no) << def::DEVICE_NO_BIT_SHIFT) |
+                                    (static_cast<canid_t>(monitor_id) << def::TARGET_ADDR_BIT_SHIFT);
+        filters.push_back({response_id, response_mask});
+    }
+    return filters;
+}
+
+struct can_filter echo_filter(uint8_t monitor_id) {
+    // any device number, group commands are sent with DEVICE_NO_GROUP
+    return {CAN_EFF_FLAG | (static_cast<canid_t>(monitor_id) << def::SOURCE_ADDR_BIT_SHIFT),
+            CAN_EFF_FLAG | CAN_RTR_FLAG | (0xFFu << def::SOURCE_ADDR_BIT_SHIFT)};
+}
+
+def::ErrorCode get_error_code(uint32_t can_id) {
+    return static_cast<def::ErrorCode>((can_id >> def::ERROR_CODE_BIT_SHIFT) & 0x07);
+}
+
+uint8_t get_device_no(uint32_t can_id) {
+    return (can_id >> def::DEVICE_NO_BIT_SHIFT) & 0x0F;
+}
+
+uint8_t get_command(uint32_t can_id) {
+    return (can_id >> def::COMMAND_NO_BIT_SHIFT) & 0x3F;
+}
+
+uint8_t get_destination(uint32_t can_id) {
+    return (can_id >> def::TARGET_ADDR_BIT_SHIFT) & 0xFF;
+}
+
+uint8_t get_source(uint32_t can_id) {
+    return (can_id >> def::SOURCE_ADDR_BIT_SHIFT) & 0xFF;
+}
+
+uint16_t request_key(uint8_t command, uint8_t peer, bool group) {
+    // command numbers have 6 bits, the top bit tells group numbers from module addresses
+    return (group ? 0x8000 : 0) | (static_cast<uint16_t>(command) << 8) | peer;
+}
+
+uint16_t request_key(const struct can_frame& frame) {
+    return request_key(get_command(frame.can_id), get_destination(frame.can_id),
+                       get_device_no(frame.can_id) == def::DEVICE_NO_GROUP);
+}
+
 void clear_frame(can_frame& frame) {
     memset(frame.data, 0, sizeof(frame.data));
 }
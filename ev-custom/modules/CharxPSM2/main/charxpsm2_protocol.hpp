@@ -32,6 +32,9 @@ enum class Command : uint8_t {
     SET_MODULE_OUTPUT_VOLTAGE_AND_CURRENT = 0x1C
 };
 
+constexpr uint8_t DEVICE_NO = 0x0A;                   // Device number of the power modules
+constexpr uint8_t DEVICE_NO_GROUP = 0x0B;             // Device number of commands to a module group, destination is the group number
+
 constexpr auto ERROR_CODE_BIT_SHIFT = 26;             // Bit shift for error code (bits 28-26)
 constexpr auto DEVICE_NO_BIT_SHIFT = 22;              // Bit shift for device number (bits 25-22)
 constexpr auto COMMAND_NO_BIT_SHIFT = 16;             // Bit shift for command number (bits 21-16)
@@ -41,10 +44,32 @@ constexpr auto SOURCE_ADDR_BIT_SHIFT = 0;             // Bit shift for source ad
 
 void prepare_frame(struct can_frame& frame, uint8_t source, uint8_t destination, def::Command commandNo, const std::vector<uint8_t>& data);
 void set_data(struct can_frame& frame, bool switch_on, bool close_input_relay);
-void set_header(struct can_frame& frame, uint8_t source, uint8_t destination, def::Command commandNo);
+void set_header(struct can_frame& frame, uint8_t source, uint8_t destination, def::Command commandNo,
+                uint8_t device_no = def::DEVICE_NO);
+// Frame addressed to all modules of a group. The modules answer one by one with their own address as source.
+void prepare_group_frame(struct can_frame& frame, uint8_t source, uint8_t group, def::Command commandNo,
+                         const std::vector<uint8_t>& data);
 void clear_frame(can_frame& frame);
 void parse_voltagecurrent(float& voltage, float& current, uint64_t& response);
 void parse_statuses(std::array<uint8_t, 5>& status_list, uint64_t& response);
+
+// Kernel receive filters for responses of any power module addressed to monitor_id, with the device number of module
+// or group commands
+std::vector<struct can_filter> response_filters(uint8_t monitor_id);
+
+// Kernel receive filter for the loopback of our own frames (source monitor_id), used as TX confirmation
+struct can_filter echo_filter(uint8_t monitor_id);
+
+// identifier field accessors
+def::ErrorCode get_error_code(uint32_t can_id);
+uint8_t get_device_no(uint32_t can_id);
+uint8_t get_command(uint32_t can_id);
+uint8_t get_destination(uint32_t can_id);
+uint8_t get_source(uint32_t can_id);
+
+// Requests in flight are keyed by command number and peer (module, group or broadcast) address
+uint16_t request_key(uint8_t command, uint8_t peer, bool group = false);
+uint16_t request_key(const struct can_frame& frame);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include "current_regulator.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+CurrentRegulator::CurrentRegulator(const Config& config) : config(config) {
+}
+
+void CurrentRegulator::update(float target, float measured, bool limited, Clock::time_point now) {
+    if (last_update != Clock::time_point{} and now - last_update < config.period) {
+        return;
+    }
+    // a late measurement must not make the integrator jump
+    const std::chrono::duration<float> dt = (last_update == Clock::time_point{})
+                                                ? Clock::duration(config.period)
+                                                : std::min<Clock::duration>(now - last_update, 2 * config.period);
+    last_update = now;
+
+    error = target - measured;
+    if (limited) {
+        integral = 0;
+        trim = 0;
+        return;
+    }
+    if (within_tolerance() or std::abs(error) > config.max_trim) {
+        // settled, or ramping or limited: hold the trim of the steady state
+        return;
+    }
+
+    const float proportional = config.kp * error;
+    const float candidate = integral + config.ki * error * dt.count();
+    const float output = proportional + candidate;
+    // conditional integration: a saturated output only lets the integrator move back
+    if (std::abs(output) <= config.max_trim or std::abs(candidate) < std::abs(integral)) {
+        integral = std::clamp(candidate, -config.max_trim, config.max_trim);
+    }
+    trim = std::clamp(proportional + integral, -config.max_trim, config.max_trim);
+}
+
+void CurrentRegulator::reset() {
+    integral = 0;
+    trim = 0;
+    error = 0;
+    last_update = {};
+}
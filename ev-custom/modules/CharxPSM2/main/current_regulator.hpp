@@ -0,0 +1,50 @@
+#ifndef Charx_PSM2_CURRENT_REGULATOR_HPP
+#define Charx_PSM2_CURRENT_REGULATOR_HPP
+
+#include <chrono>
+#include <cmath>
+
+// Outer PI loop on top of the current setpoint of the modules: trims the commanded current so the delivered current
+// matches the requested one within tolerance. Errors within the tolerance leave the trim as it is (deadband), so
+// the loop settles instead of chasing measurement noise. Only the steady state error is regulated, an error above
+// max_trim means the output is still ramping or limited. The trim is bounded by max_trim, the integrator only runs
+// while the output is not saturated (anti-windup). Not thread safe, the tasks run on the executor thread.
+class CurrentRegulator {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        std::chrono::milliseconds period{250};
+        float kp{0.2};
+        float ki{1.0}; // 1/s
+        float max_trim{5}; // A
+        float tolerance{0.5}; // A, errors within are left alone
+    };
+
+    explicit CurrentRegulator(const Config& config);
+
+    // Measured output for the target current, at most once per period. While the output is limited otherwise (at
+    // its voltage setpoint, or the command at the current envelope) the loop starts over and does not integrate.
+    void update(float target, float measured, bool limited, Clock::time_point now);
+    void reset();
+
+    // added to the current setpoint
+    float get_trim() const {
+        return trim;
+    }
+    float get_error() const {
+        return error;
+    }
+    bool within_tolerance() const {
+        return std::abs(error) <= config.tolerance;
+    }
+
+private:
+    const Config config;
+    float integral{0};
+    float trim{0};
+    float error{0};
+    Clock::time_point last_update{};
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "cycle_scheduler.hpp"
+
+#include <algorithm>
+
+static std::chrono::microseconds to_microseconds(CycleScheduler::Clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+}
+
+CycleScheduler::CycleScheduler(std::chrono::milliseconds period, double low_priority_budget) :
+    period(std::max<Clock::duration>(period, std::chrono::milliseconds(1))),
+    low_priority_budget(std::chrono::duration_cast<Clock::duration>(this->period * std::clamp(low_priority_budget, 0.0, 1.0))) {
+    statistics.period = std::chrono::duration_cast<std::chrono::milliseconds>(this->period);
+}
+
+CycleScheduler::Clock::time_point CycleScheduler::next_release() const {
+    // the first cycle starts right away
+    return (release == Clock::time_point::min()) ? Clock::now() : release;
+}
+
+void CycleScheduler::begin_cycle() {
+    cycle_start = Clock::now();
+    if (release == Clock::time_point::min()) {
+        release = cycle_start;
+    }
+
+    const auto jitter = std::max(cycle_start - release, Clock::duration(0));
+    jitter_sum += jitter;
+    statistics.jitter_max = std::max(statistics.jitter_max, to_microseconds(jitter));
+
+    if (statistics.cycles > 0) {
+        statistics.interval_max = std::max(statistics.interval_max, to_microseconds(cycle_start - previous_start));
+    }
+    previous_start = cycle_start;
+    ++statistics.cycles;
+    statistics.jitter_avg = to_microseconds(jitter_sum / statistics.cycles);
+}
+
+void CycleScheduler::end_cycle() {
+    const auto now = Clock::now();
+
+    const auto duration = now - cycle_start;
+    duration_sum += duration;
+    statistics.duration_avg = to_microseconds(duration_sum / statistics.cycles);
+    statistics.duration_max = std::max(statistics.duration_max, to_microseconds(duration));
+
+    release += period;
+    if (now >= release) {
+        // overrun, continue with the next release in the future
+        const auto missed = (now - release) / period + 1;
+        ++statistics.overruns;
+        statistics.missed_releases += missed;
+        release += missed * period;
+    }
+}
+
+bool CycleScheduler::low_priority_budget_left() {
+    if (Clock::now() - release < low_priority_budget) {
+        return true;
+    }
+    ++statistics.skipped_work;
+    return false;
+}
+
+void CycleScheduler::count_skipped_work() {
+    ++statistics.skipped_work;
+}
+
+CycleScheduler::Statistics CycleScheduler::get_statistics() const {
+    return statistics;
+}
@@ -0,0 +1,59 @@
+#ifndef Charx_PSM2_CYCLE_SCHEDULER_HPP
+#define Charx_PSM2_CYCLE_SCHEDULER_HPP
+
+#include <chrono>
+#include <cstdint>
+
+// Absolute deadline scheduling of a periodic task. Cycle k is released at start + k * period, no
+// matter how long the previous cycles took, so the command interval does not drift. A cycle that runs past its
+// next release is an overrun, the releases it missed are skipped instead of being run back to back.
+class CycleScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // The PSM2 needs a control command every 50 ms to 200 ms, the limits of the control task period
+    constexpr static auto MIN_PERIOD = std::chrono::milliseconds(50);
+    constexpr static auto MAX_PERIOD = std::chrono::milliseconds(200);
+
+    struct Statistics {
+        std::chrono::milliseconds period{0};
+        uint64_t cycles{0};
+        uint64_t overruns{0};        // cycles which ran past the next release
+        uint64_t missed_releases{0}; // releases skipped because of overruns
+        uint64_t skipped_work{0};    // low priority work left out for lack of budget
+        std::chrono::microseconds jitter_avg{0}; // release to actual start of the cycle
+        std::chrono::microseconds jitter_max{0};
+        std::chrono::microseconds duration_avg{0};
+        std::chrono::microseconds duration_max{0};
+        std::chrono::microseconds interval_max{0}; // longest time between the start of two cycles
+    };
+
+    // low_priority_budget is the share of the period after which low priority work is skipped
+    CycleScheduler(std::chrono::milliseconds period, double low_priority_budget);
+
+    // release time of the next cycle, wait for it with SequenceExecutor::sleep_until()
+    Clock::time_point next_release() const;
+
+    void begin_cycle();
+    void end_cycle();
+
+    // true while the current cycle has budget for low priority work, counts the work skipped otherwise
+    bool low_priority_budget_left();
+    // work left out for other reasons, e.g. the CAN bus budget
+    void count_skipped_work();
+
+    Statistics get_statistics() const;
+
+private:
+    const Clock::duration period;
+    const Clock::duration low_priority_budget;
+    Clock::time_point release{Clock::time_point::min()};
+    Clock::time_point cycle_start;
+    Clock::time_point previous_start;
+
+    Statistics statistics;
+    Clock::duration jitter_sum{0};
+    Clock::duration duration_sum{0};
+};
+
+#endif
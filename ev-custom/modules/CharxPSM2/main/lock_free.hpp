@@ -0,0 +1,151 @@
+#ifndef Charx_PSM2_LOCK_FREE_HPP
+#define Charx_PSM2_LOCK_FREE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Hand-over primitives between the CAN broker thread and its users. None of them takes a lock, so the broker
+// thread never waits for a thread that got preempted while holding one.
+
+// Single producer/single consumer ring buffer, N has to be a power of two
+template <typename T, std::size_t N> class SpscRing {
+    static_assert((N & (N - 1)) == 0, "SpscRing size has to be a power of two");
+
+public:
+    // producer only, returns false if the ring is full
+    bool push(const T& value) {
+        const auto head_index = head.load(std::memory_order_relaxed);
+        if (head_index - tail.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        buffer[head_index & (N - 1)] = value;
+        head.store(head_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only, returns false if the ring is empty
+    bool pop(T& value) {
+        const auto tail_index = tail.load(std::memory_order_relaxed);
+        if (tail_index == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = buffer[tail_index & (N - 1)];
+        tail.store(tail_index + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, N> buffer;
+    alignas(64) std::atomic<std::size_t> head{0}; // next slot to write
+    alignas(64) std::atomic<std::size_t> tail{0}; // next slot to read
+};
+
+// Multiple producer/single consumer queue of intrusive nodes (Vyukov), T needs a std::atomic<T*> next_node member.
+// Producers never wait, the consumer may see an empty queue while a push is half done; the producer wakes it
+// up afterwards anyway.
+template <typename T> class MpscQueue {
+public:
+    MpscQueue() : head(&stub), tail(&stub) {
+        stub.next_node.store(nullptr, std::memory_order_relaxed);
+    }
+
+    void push(T* node) {
+        node->next_node.store(nullptr, std::memory_order_relaxed);
+        T* previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next_node.store(node, std::memory_order_release);
+    }
+
+    // consumer only, nullptr if empty
+    T* pop() {
+        T* first = tail;
+        T* next = first->next_node.load(std::memory_order_acquire);
+
+        if (first == &stub) {
+            if (next == nullptr) {
+                return nullptr;
+            }
+            tail = next;
+            first = next;
+            next = next->next_node.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr) {
+            tail = next;
+            return first;
+        }
+
+        if (first != head.load(std::memory_order_acquire)) {
+            // a producer is between exchange and link
+            return nullptr;
+        }
+
+        push(&stub);
+        next = first->next_node.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            tail = next;
+            return first;
+        }
+        return nullptr;
+    }
+
+private:
+    T stub;
+    std::atomic<T*> head;
+    T* tail;
+};
+
+// Futex based event: waiters sleep until notify_all() changed the sequence number they have seen
+class FutexEvent {
+public:
+    uint32_t sequence() const {
+        return sequence_number.load(std::memory_order_acquire);
+    }
+
+    void notify_all() {
+        sequence_number.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &sequence_number, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    // returns false if the timeout passed without notification
+    bool wait(uint32_t seen_sequence, std::optional<std::chrono::nanoseconds> timeout = std::nullopt) {
+        struct timespec relative;
+        if (timeout) {
+            const auto remaining = std::max(*timeout, std::chrono::nanoseconds(0));
+            relative.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(remaining).count();
+            relative.tv_nsec = (remaining % std::chrono::seconds(1)).count();
+        }
+
+        // returns immediately if the sequence number changed in between
+        syscall(SYS_futex, &sequence_number, FUTEX_WAIT_PRIVATE, seen_sequence, timeout ? &relative : nullptr, nullptr,
+                0);
+        return sequence() != seen_sequence;
+    }
+
+    // like wait(), with an absolute deadline on CLOCK_MONOTONIC (std::chrono::steady_clock), so a periodic
+    // waiter does not drift by the time it took to compute its timeout
+    bool wait_until(uint32_t seen_sequence, std::chrono::steady_clock::time_point deadline) {
+        const auto since_epoch = std::max(deadline.time_since_epoch(), std::chrono::steady_clock::duration(0));
+        struct timespec absolute;
+        absolute.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+        absolute.tv_nsec = (since_epoch % std::chrono::seconds(1)).count();
+
+        syscall(SYS_futex, &sequence_number, FUTEX_WAIT_BITSET_PRIVATE, seen_sequence, &absolute, nullptr,
+                FUTEX_BITSET_MATCH_ANY);
+        return sequence() != seen_sequence;
+    }
+
+private:
+    std::atomic<uint32_t> sequence_number{0};
+};
+
+#endif
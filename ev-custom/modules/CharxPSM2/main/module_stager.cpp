@@ -0,0 +1,79 @@
+#include "module_stager.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+ModuleStager::ModuleStager(const Config& config) : config(config) {
+}
+
+// modules for the power, kept as long as their load stays in the hysteresis band
+std::size_t ModuleStager::target_count(float power, std::size_t available) const {
+    const float module_power = std::max(config.module_power, 1.0f);
+    const float optimal_load = std::clamp(config.optimal_load, 0.1f, 1.0f);
+
+    const std::size_t running = active.size();
+    if (running > 0) {
+        const float load = power / (running * module_power);
+        const bool above = load > optimal_load * (1 + config.hysteresis);
+        // one module less would run above the band, the last module runs at any low load
+        const bool below = running > 1 and power / ((running - 1) * module_power) < optimal_load * (1 - config.hysteresis);
+        if (not above and not below) {
+            return std::min(running, available);
+        }
+    }
+
+    const auto optimal = static_cast<std::size_t>(std::lround(power / (module_power * optimal_load)));
+    return std::clamp<std::size_t>(optimal, 1, available);
+}
+
+const std::vector<uint8_t>& ModuleStager::update(bool enabled, float power, const std::vector<Candidate>& candidates,
+                                                 Clock::time_point now) {
+    if (not enabled or candidates.empty()) {
+        if (not active.empty()) {
+            active.clear();
+            last_change = now;
+            ++stage_changes;
+        }
+        return active;
+    }
+
+    // modules that stopped answering leave at once
+    std::erase_if(active, [&](uint8_t module_address) {
+        return std::none_of(candidates.begin(), candidates.end(),
+                            [&](const Candidate& candidate) { return candidate.module_address == module_address; });
+    });
+
+    // the running modules must be able to deliver the power, this does not wait for the hold time
+    const float module_power = std::max(config.module_power, 1.0f);
+    const auto needed =
+        std::min<std::size_t>(std::max<std::size_t>(1, std::ceil(power / module_power)), candidates.size());
+    auto count = target_count(power, candidates.size());
+    if (not active.empty() and now < last_change + config.hold) {
+        count = std::max(needed, std::min(active.size(), candidates.size()));
+    }
+    count = std::max(count, needed);
+
+    // cool modules first, running ones before idle ones so the set only changes when it must
+    auto ranked = candidates;
+    const auto rank = [&](const Candidate& candidate) {
+        const bool hot = candidate.temperature >= config.temperature_limit;
+        const bool idle = std::find(active.begin(), active.end(), candidate.module_address) == active.end();
+        return std::make_tuple(hot, idle, candidate.temperature, candidate.module_address);
+    };
+    std::sort(ranked.begin(), ranked.end(),
+              [&](const Candidate& a, const Candidate& b) { return rank(a) < rank(b); });
+
+    std::vector<uint8_t> staged;
+    for (std::size_t index = 0; index < count; ++index) {
+        staged.push_back(ranked[index].module_address);
+    }
+    std::sort(staged.begin(), staged.end());
+
+    if (staged != active) {
+        active = std::move(staged);
+        last_change = now;
+        ++stage_changes;
+    }
+    return active;
+}
@@ -0,0 +1,53 @@
+#ifndef Charx_PSM2_MODULE_STAGER_HPP
+#define Charx_PSM2_MODULE_STAGER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Chooses how many and which power modules deliver the requested power. Each running module is kept near
+// optimal_load of its rated power, where its conversion efficiency is highest. The count only moves once the load
+// per module leaves the hysteresis band around that point and the last change is hold ago, unless the running
+// modules could not deliver the power otherwise. The coolest modules run, a module above temperature_limit only if
+// there is no other one. Not thread safe, the tasks run on the executor thread.
+class ModuleStager {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        float module_power{15000};  // W, rated output power of one module
+        float optimal_load{0.6};    // share of module_power with the best efficiency
+        float hysteresis{0.15};     // relative band around optimal_load without a change
+        uint8_t temperature_limit{75}; // C
+        std::chrono::milliseconds hold{5000};
+    };
+
+    struct Candidate {
+        uint8_t module_address;
+        uint8_t temperature;
+    };
+
+    explicit ModuleStager(const Config& config);
+
+    // Modules to run for the requested power, out of the candidates (the modules that answer). Without power
+    // demand (enabled false) no module runs.
+    const std::vector<uint8_t>& update(bool enabled, float power, const std::vector<Candidate>& candidates,
+                                       Clock::time_point now);
+
+    const std::vector<uint8_t>& get_active() const {
+        return active;
+    }
+    uint64_t get_stage_changes() const {
+        return stage_changes;
+    }
+
+private:
+    std::size_t target_count(float power, std::size_t available) const;
+
+    const Config config;
+    std::vector<uint8_t> active;
+    Clock::time_point last_change{};
+    uint64_t stage_changes{0};
+};
+
+#endif
@@ -0,0 +1,464 @@
+#include "power_module_bus.hpp"
+
+#include <algorithm>
+
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+#include <everest/logging.hpp>
+
+#include "power_supply_connector.hpp"
+
+void log_status_on_fail(const std::string& msg, CanBroker::AccessReturnType status) {
+    // CAN request returns status, this function logs failed request
+    using ReturnStatus = CanBroker::AccessReturnType;
+
+    std::string reason;
+    switch (status) {
+    case ReturnStatus::FAILED:
+        reason = "failed";
+        EVLOG_warning << msg << " reason: (" << reason << ")";
+        break;
+    case ReturnStatus::NOT_READY:
+        reason = "not ready";
+        EVLOG_warning << msg << " reason: (" << reason << ")";
+        break;
+    case ReturnStatus::TIMEOUT:
+        reason = "timeout";
+        EVLOG_warning << msg << " reason: (" << reason << ")";
+        break;
+    default:
+        return;
+    }
+}
+
+PowerModuleBus::PowerModuleBus(const Config& config, Publish publish) :
+    config(config), publish_message(std::move(publish)) {
+    module_health.resize(config.number_of_power_modules);
+    module_telemetry.resize(config.number_of_power_modules);
+    module_states.resize(config.number_of_power_modules);
+
+    if (config.reactor_mode) {
+        reactor = std::make_unique<Reactor>();
+        can_broker = std::make_unique<CanBroker>(config.device, config.broker, *reactor);
+    } else {
+        can_broker = std::make_unique<CanBroker>(config.device, config.broker);
+    }
+    can = std::make_unique<CanSequence>(*can_broker, executor);
+}
+
+PowerModuleBus::~PowerModuleBus() = default;
+
+void PowerModuleBus::add_connector(PowerSupplyConnector& connector) {
+    connectors.push_back(&connector);
+}
+
+void PowerModuleBus::run() {
+    // independent periodic tasks, all of them take their CAN frames from one bus budget
+    const double frames_per_second = config.bus_budget_frames_per_s;
+    bus_budget = std::make_unique<BusBudget>(frames_per_second, std::max(frames_per_second / 10, 2 * control_frames()));
+
+    executor.spawn(module_status_task(*can));
+    executor.spawn(module_info_task(*can));
+    executor.spawn(module_telemetry_task(*can));
+
+    if (not reactor) {
+        executor.run();
+        return;
+    }
+
+    // reactor mode: CAN I/O, the control cycles and setpoint updates share this thread
+    executor.attach(*reactor);
+    reactor->run();
+}
+
+// Connection (number of power modules) and the status of every module
+CanTask PowerModuleBus::module_status_task(CanSequence& can) {
+    CycleScheduler scheduler(config.status_period, config.low_priority_budget);
+
+    while (true) {
+        co_await can.get_executor().sleep_until(scheduler.next_release());
+        scheduler.begin_cycle();
+
+        // try to connect, read number of power modules in the system
+        if (bus_budget->try_acquire(broadcast_frames(), control_frames())) {
+            EVLOG_info << "Trying to read number of modules";
+            const auto modules = co_await can.read_number_of_modules();
+            const bool power_modules_connected = modules.status == CanBroker::AccessReturnType::SUCCESS;
+            if (power_modules_connected and modules.value != active_number_of_pwr_mdls) {
+                if (modules.value < config.number_of_power_modules) {
+                    EVLOG_warning << "Continuing with " << static_cast<int>(modules.value) << " of "
+                                  << static_cast<int>(config.number_of_power_modules) << " power modules";
+                } else if (modules.value == config.number_of_power_modules) {
+                    EVLOG_info << "All " << static_cast<int>(modules.value) << " power modules present";
+                }
+                active_number_of_pwr_mdls = modules.value;
+            }
+
+            // Continue with the modules that are present, the connectors scale their limits to the modules that
+            // answer. More modules than expected point to a wrong configuration.
+            connected = power_modules_connected and active_number_of_pwr_mdls > 0 and
+                        active_number_of_pwr_mdls <= config.number_of_power_modules;
+        } else {
+            scheduler.count_skipped_work();
+        }
+
+        // Statuses of all power modules with one broadcast, left out once the cycle or the bus used up its budget.
+        // Dead modules are not waited for, they are probed on their own with backoff.
+        if (connected and scheduler.low_priority_budget_left()) {
+            std::vector<uint8_t> module_addresses;
+            const auto now = std::chrono::steady_clock::now();
+            for (uint8_t module_address = 0x00; module_address < config.number_of_power_modules; module_address++) {
+                auto& health = module_health[module_address];
+                if (health.failures < DEAD_MODULE_FAILURES) {
+                    module_addresses.push_back(module_address);
+                } else if (not health.probe_running and now >= health.next_probe_at) {
+                    // a probe the bus budget refuses waits for the backoff as well
+                    health.probe_running = true;
+                    health.next_probe_at = now + health.backoff;
+                    can.get_executor().spawn(probe_module_task(can, module_address));
+                }
+            }
+
+            if (module_addresses.empty()) {
+                // all modules are dead, only the probes run
+            } else if (not bus_budget->try_acquire(broadcast_frames(), control_frames())) {
+                scheduler.count_skipped_work();
+            } else {
+                EVLOG_info << "read power module statuses";
+                const auto module_statuses = co_await can.read_power_module_statuses(module_addresses);
+                if (module_statuses.status == CanBroker::AccessReturnType::NOT_READY) {
+                    // the broadcast did not go out, there is nothing to report per module
+                    log_status_on_fail("Error reading power module statuses", module_statuses.status);
+                } else {
+                    // modules without answer are reported as timeout
+                    for (const auto& module_status : module_statuses.value) {
+                        handle_module_status(module_status.module_address, module_status.status,
+                                             module_status.status_list);
+                    }
+                }
+            }
+        }
+
+        for (auto* connector : connectors) {
+            connector->handle_status_sweep();
+        }
+
+        scheduler.end_cycle();
+        report_cycle("status", scheduler);
+    }
+}
+
+// Information block of every module, rarely changes
+CanTask PowerModuleBus::module_info_task(CanSequence& can) {
+    CycleScheduler scheduler(config.module_info_period, config.low_priority_budget);
+
+    while (true) {
+        // the first read waits for the connection
+        if (not connected) {
+            co_await can.get_executor().sleep_for(config.status_period);
+            continue;
+        }
+
+        co_await can.get_executor().sleep_until(scheduler.next_release());
+        scheduler.begin_cycle();
+
+        for (uint8_t module_address = 0x00; connected and module_address < config.number_of_power_modules;
+             module_address++) {
+            // missing modules are read again once they answer their status
+            if (not module_alive(module_address)) {
+                continue;
+            }
+            if (not bus_budget->try_acquire(UNICAST_FRAMES, control_frames())) {
+                scheduler.count_skipped_work();
+                break;
+            }
+            const auto info = co_await can.read_module_info(module_address);
+            log_status_on_fail("Error reading info of power module " + std::to_string(module_address), info.status);
+            if (info.status == CanBroker::AccessReturnType::SUCCESS) {
+                EVLOG_info << fmt::format("Power module {} info: {:02X}", module_address, fmt::join(info.value, " "));
+            }
+        }
+
+        scheduler.end_cycle();
+        report_cycle("module_info", scheduler);
+    }
+}
+
+bool PowerModuleBus::module_alive(uint8_t module_address) const {
+    return module_health[module_address].failures < DEAD_MODULE_FAILURES;
+}
+
+double PowerModuleBus::broadcast_frames() const {
+    return 1 + config.number_of_power_modules;
+}
+
+double PowerModuleBus::control_frames() const {
+    return 2 * broadcast_frames() * std::max<std::size_t>(1, connectors.size());
+}
+
+// cycle timing of a task about every 10 s
+void PowerModuleBus::report_cycle(const std::string& task, const CycleScheduler& scheduler) {
+    const auto stats = scheduler.get_statistics();
+    const uint64_t interval = std::max<uint64_t>(1, 10000 / std::max<int64_t>(1, stats.period.count()));
+    if (stats.cycles % interval != 0) {
+        return;
+    }
+
+    publish_cycle_statistics(task, stats);
+    if (task == "control" and config.debug_print_all_telemetry) {
+        log_latency_statistics();
+    }
+}
+
+// Output voltage and current of each module, to spot modules which do not take their share of the current
+CanTask PowerModuleBus::module_telemetry_task(CanSequence& can) {
+    CycleScheduler scheduler(config.module_telemetry_period, config.low_priority_budget);
+
+    while (true) {
+        co_await can.get_executor().sleep_until(scheduler.next_release());
+        scheduler.begin_cycle();
+
+        // dead modules would only hold up the broadcast until the timeout
+        std::vector<uint8_t> module_addresses;
+        for (uint8_t module_address = 0x00; module_address < config.number_of_power_modules; module_address++) {
+            if (module_alive(module_address)) {
+                module_addresses.push_back(module_address);
+            }
+        }
+
+        if (not connected or module_addresses.empty()) {
+            // nothing to read
+        } else if (not bus_budget->try_acquire(broadcast_frames(), control_frames())) {
+            scheduler.count_skipped_work();
+        } else {
+            const auto values = co_await can.read_module_voltages_currents(module_addresses);
+            for (const auto& value : values.value) {
+                auto& telemetry = module_telemetry[value.module_address];
+                telemetry.valid = value.status == CanBroker::AccessReturnType::SUCCESS;
+                if (telemetry.valid) {
+                    telemetry.voltage = value.voltage;
+                    telemetry.current = value.current;
+                }
+            }
+            publish_module_telemetry();
+        }
+
+        scheduler.end_cycle();
+        report_cycle("module_telemetry", scheduler);
+    }
+}
+
+// Per module values with the share of the current relative to the average of all modules, 1 is an even share
+void PowerModuleBus::publish_module_telemetry() {
+    float current_sum = 0;
+    int valid_modules = 0;
+    for (const auto& telemetry : module_telemetry) {
+        if (telemetry.valid) {
+            current_sum += telemetry.current;
+            ++valid_modules;
+        }
+    }
+    const float current_avg = (valid_modules > 0) ? current_sum / valid_modules : 0;
+
+    for (std::size_t module_address = 0; module_address < module_telemetry.size(); ++module_address) {
+        const auto& telemetry = module_telemetry[module_address];
+        if (not telemetry.valid) {
+            continue;
+        }
+        // without output current there is nothing to share
+        const float share = (current_avg > MIN_SHARED_CURRENT) ? telemetry.current / current_avg : 1;
+        const auto json = fmt::format("{{\"voltage_V\":{:.2f},\"current_A\":{:.2f},\"current_share\":{:.3f}}}",
+                                      telemetry.voltage, telemetry.current, share);
+        publish(fmt::format("everest/charxpsm2/module/{}/voltage_current", module_address), json);
+
+        if (config.debug_print_all_telemetry) {
+            EVLOG_info << "Power module " << module_address << ": " << json;
+        }
+    }
+}
+
+// Status read of a single dead module, runs alongside the status task so several probes are on the bus at once. The
+// status task marks the probe running and schedules the next one before it spawns it.
+CanTask PowerModuleBus::probe_module_task(CanSequence& can, uint8_t module_address) {
+    auto& health = module_health[module_address];
+    if (not bus_budget->try_acquire(UNICAST_FRAMES, control_frames())) {
+        health.probe_running = false;
+        co_return;
+    }
+
+    const auto module_status = co_await can.read_power_module_status(module_address);
+    health.probe_running = false;
+    handle_module_status(module_address, module_status.status, module_status.value);
+}
+
+// Result of a status read, updates the health of the module. After DEAD_MODULE_FAILURES failures in a row the
+// module is dead and probed with exponential backoff until it answers again.
+void PowerModuleBus::handle_module_status(uint8_t module_address, CanBroker::AccessReturnType status,
+                                          const std::array<uint8_t, 5>& module_status) {
+    auto& health = module_health[module_address];
+
+    if (status == CanBroker::AccessReturnType::SUCCESS) {
+        if (health.failures >= DEAD_MODULE_FAILURES) {
+            EVLOG_info << "Power module 0x0" << static_cast<int>(module_address) << " answers again";
+        }
+        health.failures = 0;
+        health.backoff = std::chrono::milliseconds(0);
+        module_states[module_address].group = module_status[0];
+        module_states[module_address].temperature = module_status[1];
+        status_array = module_status;
+        handle_statuses(status_array);
+        return;
+    }
+
+    std::string message = "Error reading status of power module 0x0" + std::to_string(module_address);
+    log_status_on_fail(message, status);
+
+    if (++health.failures < DEAD_MODULE_FAILURES) {
+        return;
+    }
+    if (health.failures == DEAD_MODULE_FAILURES) {
+        EVLOG_warning << "Power module 0x0" << static_cast<int>(module_address)
+                      << " does not answer, probing it with backoff";
+    }
+    health.backoff = std::min(std::max(health.backoff * 2, config.status_period), MAX_PROBE_BACKOFF);
+    health.next_probe_at = std::chrono::steady_clock::now() + health.backoff;
+}
+
+void PowerModuleBus::publish(const std::string& topic, const std::string& payload) {
+    publish_message(topic, payload);
+}
+
+void PowerModuleBus::log_latency_statistics() {
+    for (const auto& [command, stats] : can_broker->get_latency_statistics()) {
+        EVLOG_info << fmt::format("CAN command 0x{:02X}: {} samples, bus {}/{}/{} us (min/avg/max), "
+                                  "tx queue {}/{} us (avg/max), wakeup {}/{} us (avg/max), timeout {} ms, {} retries",
+                                  command, stats.samples, stats.bus_min.count(), stats.bus_avg.count(),
+                                  stats.bus_max.count(), stats.tx_delay_avg.count(), stats.tx_delay_max.count(),
+                                  stats.wakeup_avg.count(), stats.wakeup_max.count(), stats.timeout.count(),
+                                  stats.hedged_retries);
+    }
+
+    constexpr std::array<const char*, CanBroker::TX_CLASS_COUNT> tx_class_names{"safety", "setpoint", "telemetry",
+                                                                                 "status", "info"};
+    const auto tx_statistics = can_broker->get_tx_statistics();
+    for (std::size_t index = 0; index < tx_statistics.size(); ++index) {
+        const auto& stats = tx_statistics[index];
+        EVLOG_info << fmt::format("CAN TX {}: {} sent, {} stale dropped, {} coalesced, {} rejected, {} throttled",
+                                  tx_class_names[index], stats.sent, stats.dropped_stale, stats.coalesced,
+                                  stats.rejected, stats.throttled);
+    }
+}
+
+void PowerModuleBus::publish_cycle_statistics(const std::string& task, const CycleScheduler::Statistics& stats) {
+    const auto json = fmt::format("{{\"period_ms\":{},\"cycles\":{},\"overruns\":{},\"missed_releases\":{},"
+                                  "\"skipped_work\":{},\"jitter_avg_us\":{},\"jitter_max_us\":{},"
+                                  "\"duration_avg_us\":{},\"duration_max_us\":{},\"interval_max_us\":{}}}",
+                                  stats.period.count(), stats.cycles, stats.overruns, stats.missed_releases,
+                                  stats.skipped_work, stats.jitter_avg.count(), stats.jitter_max.count(),
+                                  stats.duration_avg.count(), stats.duration_max.count(), stats.interval_max.count());
+    publish("everest/charxpsm2/cycle/" + task, json);
+
+    if (config.debug_print_all_telemetry) {
+        EVLOG_info << "Cycle " << task << ": " << json << ", bus budget refused " << bus_budget->get_refused();
+    }
+}
+
+void PowerModuleBus::drain_received_frames() {
+    // responses of the last cycle, as the CAN broker thread received them
+    can_broker->drain_received([this](const CanBroker::ReceivedFrame& frame) {
+        if (config.debug_print_all_telemetry) {
+            EVLOG_debug << fmt::format("CAN rx {} ns: command 0x{:02X} from 0x{:02X}, error {}, data {:02X}",
+                                       frame.timestamp.count(), frame.command, frame.source,
+                                       static_cast<int>(frame.error_code),
+                                       fmt::join(frame.data, " "));
+        }
+    });
+
+    const auto rx_overruns = can_broker->get_rx_overruns();
+    if (rx_overruns != reported_rx_overruns) {
+        EVLOG_warning << "CAN receive ring overrun, " << (rx_overruns - reported_rx_overruns) << " frames dropped";
+        reported_rx_overruns = rx_overruns;
+    }
+}
+
+void PowerModuleBus::handle_statuses(std::array<uint8_t, 5>& status_array) {
+    uint8_t power_module_group = status_array[0];
+    uint8_t power_module_temp = status_array[1];
+
+    uint8_t power_module_status2 = status_array[2];
+    uint8_t power_module_status1 = status_array[3];
+    uint8_t power_module_status0 = status_array[4];
+
+    handle_status2(power_module_status2);
+    handle_status1(power_module_status1);
+    handle_status0(power_module_status0);
+}
+
+void PowerModuleBus::handle_status2(uint8_t power_module_status) {
+    if (power_module_status & 1 == 1) {
+        EVLOG_warning << "Output power limitation";
+    }
+    if (power_module_status & 2 == 1) {
+        EVLOG_warning << "Module ID repetition";
+    }
+    if (power_module_status & 3 == 1) {
+        EVLOG_warning << "Load sharing";
+    }
+    if (power_module_status & 4 == 1) {
+        EVLOG_warning << "Input phase lost";
+    }
+    if (power_module_status & 5 == 1) {
+        EVLOG_warning << "Input asymmetry";
+    }
+    if (power_module_status & 6 == 1) {
+        EVLOG_warning << "Undervoltage at the input";
+    }
+    if (power_module_status & 7 == 1) {
+        EVLOG_warning << "OOvervoltage at the input";
+    }
+    if (power_module_status & 8 == 1) {
+        EVLOG_warning << "PFC circuit is OFF";
+    }
+}
+
+void PowerModuleBus::handle_status1(uint8_t power_module_status) {
+    if (power_module_status & 1 == 1) {
+        EVLOG_warning << "DC side is OFF";
+    }
+    if (power_module_status & 2 == 1) {
+        EVLOG_warning << "Module error";
+    }
+    if (power_module_status & 3 == 1) {
+        EVLOG_warning << "Module protection";
+    }
+    if (power_module_status & 4 == 1) {
+        EVLOG_warning << "Fan error";
+    }
+    if (power_module_status & 5 == 1) {
+        EVLOG_warning << "Temperature threshold value exceeded";
+    }
+    if (power_module_status & 6 == 1) {
+        EVLOG_warning << "Overvoltage at the output";
+    }
+    if (power_module_status & 7 == 1) {
+        EVLOG_warning << "Slow startup ";
+    }
+    if (power_module_status & 8 == 1) {
+        EVLOG_warning << "CAN command interruption";
+    }
+}
+
+void PowerModuleBus::handle_status0(uint8_t power_module_status) {
+    if (power_module_status & 1 == 1) {
+        EVLOG_warning << "Output short circuit ";
+    }
+    if (power_module_status & 3 == 1) {
+        EVLOG_warning << "Internal communication interruption ";
+    }
+    if (power_module_status & 4 == 1) {
+        EVLOG_warning << "PFC circuit abnormal";
+    }
+    if (power_module_status & 6 == 1) {
+        EVLOG_warning << "Discharge abnormal";
+    }
+}
@@ -0,0 +1,166 @@
+#ifndef Charx_PSM2_POWER_MODULE_BUS_HPP
+#define Charx_PSM2_POWER_MODULE_BUS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bus_budget.hpp"
+#include "can_broker.hpp"
+#include "can_sequence.hpp"
+#include "current_regulator.hpp"
+#include "cycle_scheduler.hpp"
+#include "module_stager.hpp"
+#include "reactor.hpp"
+#include "thermal_derating.hpp"
+
+class PowerSupplyConnector;
+
+// Logs the status of a failed CAN request
+void log_status_on_fail(const std::string& msg, CanBroker::AccessReturnType status);
+
+// Everything the connectors of one CAN bus share: the CAN broker, the executor the command sequences run on, the
+// bus budget and what is known about each power module. The module wide tasks (module count and status, module
+// telemetry, module info) run here once, the connectors only run their control and telemetry tasks.
+class PowerModuleBus {
+public:
+    using Publish = std::function<void(const std::string& topic, const std::string& payload)>;
+
+    struct Config {
+        std::string device;
+        CanBroker::Config broker;
+        bool reactor_mode{false};
+        uint8_t number_of_power_modules{0};
+        std::chrono::milliseconds control_period{125};
+        std::chrono::milliseconds setpoint_min_spacing{10};
+        std::chrono::milliseconds setpoint_keepalive{150};
+        double low_priority_budget{0.6};
+        std::chrono::milliseconds telemetry_period{100};
+        std::chrono::milliseconds status_period{1000};
+        std::chrono::milliseconds module_telemetry_period{1000};
+        std::chrono::milliseconds module_info_period{60000};
+        double bus_budget_frames_per_s{400};
+        bool module_staging{false}; // per module readiness and setpoint, only as many modules as the load needs
+        ModuleStager::Config staging;
+        ThermalDerating::Config derating;
+        bool current_regulation{false}; // PI loop trimming the current setpoint to the measured current
+        CurrentRegulator::Config regulation; // its tolerance is published in the capabilities
+        bool debug_print_all_telemetry{false};
+    };
+
+    // CAN frames of a request to one module and its response
+    constexpr static double UNICAST_FRAMES = 2;
+
+    // Status read health of a module. Dead modules are left out of the status broadcast, which would otherwise
+    // wait for them until the timeout on every cycle.
+    constexpr static uint32_t DEAD_MODULE_FAILURES = 3;
+    constexpr static auto MAX_PROBE_BACKOFF = std::chrono::milliseconds(30000);
+    struct ModuleHealth {
+        uint32_t failures{0}; // status reads failed in a row
+        std::chrono::milliseconds backoff{0};
+        std::chrono::steady_clock::time_point next_probe_at{};
+        bool probe_running{false};
+    };
+
+    // Latest output values of a module
+    constexpr static float MIN_SHARED_CURRENT = 0.5; // A, below the current share is not meaningful
+    struct ModuleTelemetry {
+        float voltage{0};
+        float current{0};
+        bool valid{false};
+    };
+
+    // Group and temperature from the last status of a module
+    constexpr static uint8_t NO_GROUP = 0xFF;
+    struct ModuleState {
+        uint8_t group{NO_GROUP};
+        uint8_t temperature{0};
+    };
+
+    PowerModuleBus(const Config& config, Publish publish);
+    PowerModuleBus(const PowerModuleBus&) = delete;
+    PowerModuleBus& operator=(const PowerModuleBus&) = delete;
+    ~PowerModuleBus();
+
+    // The connector spawns its tasks on the executor before run(), it is told about every status sweep
+    void add_connector(PowerSupplyConnector& connector);
+
+    // Runs the module wide tasks and the tasks of all connectors on this thread, does not return
+    void run();
+
+    const Config& get_config() const {
+        return config;
+    }
+    CanSequence& get_can() {
+        return *can;
+    }
+    // reactor mode only, nullptr otherwise
+    Reactor* get_reactor() {
+        return reactor.get();
+    }
+    BusBudget& get_budget() {
+        return *bus_budget;
+    }
+
+    // executor thread only
+    bool modules_connected() const {
+        return connected;
+    }
+    bool module_alive(uint8_t module_address) const;
+    const ModuleState& get_module_state(uint8_t module_address) const {
+        return module_states[module_address];
+    }
+
+    // CAN frames of a broadcast request: the request and a response of every module
+    double broadcast_frames() const;
+    // frames of one control cycle of every connector, kept in reserve by the other tasks
+    double control_frames() const;
+
+    void report_cycle(const std::string& task, const CycleScheduler& scheduler);
+    void drain_received_frames();
+    void publish(const std::string& topic, const std::string& payload);
+
+private:
+    CanTask module_status_task(CanSequence& can);
+    CanTask module_info_task(CanSequence& can);
+    CanTask probe_module_task(CanSequence& can, uint8_t module_address);
+    CanTask module_telemetry_task(CanSequence& can);
+    void publish_module_telemetry();
+    void handle_module_status(uint8_t module_address, CanBroker::AccessReturnType status,
+                              const std::array<uint8_t, 5>& module_status);
+
+    void log_latency_statistics();
+    void publish_cycle_statistics(const std::string& task, const CycleScheduler::Statistics& stats);
+
+    void handle_statuses(std::array<uint8_t, 5>& status_array);
+    void handle_status2(uint8_t power_module_status);
+    void handle_status1(uint8_t power_module_status);
+    void handle_status0(uint8_t power_module_status);
+
+    const Config config;
+    Publish publish_message;
+
+    std::unique_ptr<Reactor> reactor; // reactor mode only, declared first so it outlives the broker
+    std::unique_ptr<CanBroker> can_broker;
+    SequenceExecutor executor;
+    std::unique_ptr<CanSequence> can;
+    std::unique_ptr<BusBudget> bus_budget;
+
+    std::vector<PowerSupplyConnector*> connectors;
+
+    bool connected{false};
+    uint8_t active_number_of_pwr_mdls{0};
+    std::array<uint8_t, 5> status_array;
+    uint64_t reported_rx_overruns{0};
+
+    // indexed by module address
+    std::vector<ModuleHealth> module_health;
+    std::vector<ModuleTelemetry> module_telemetry;
+    std::vector<ModuleState> module_states;
+};
+
+#endif
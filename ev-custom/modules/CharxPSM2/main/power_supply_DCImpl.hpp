@@ -13,6 +13,7 @@
 
 // ev@75ac1216-19eb-4182-a85c-820f1fc2c091:v1
 // insert your custom include headers here
+#include "power_supply_connector.hpp"
 // ev@75ac1216-19eb-4182-a85c-820f1fc2c091:v1
 
 namespace module {
@@ -49,31 +50,7 @@ private:
     virtual void ready() override;
 
     // ev@3370e4dd-95f4-47a9-aaec-ea76f34a66c9:v1
-    void system_broadcast_loop();
-    void group_broadcast_loop();
-
-    void handle_statuses(std::array<uint8_t, 5>& status_array);
-    void handle_status2(uint8_t power_module_status);
-    void handle_status1(uint8_t power_module_status);
-    void handle_status0(uint8_t power_module_status);
-
-    bool powermeter_simulated;
-
-    float config_current_limit{0};
-    float config_voltage_limit{0};
-    float config_power_limit{0};
-    float config_min_voltage_limit{50.};
-    int config_power_modules_count;
-    int config_broadcast_mode;
-    int config_pwr_mdl_group_id;
-    uint8_t config_power_modules_number;
-
-    uint8_t active_number_of_pwr_mdls;
-
-    std::atomic<float> voltage;
-    std::atomic<float> current;
-
-    std::array<uint8_t, 5> status_array;
+    std::unique_ptr<PowerSupplyConnector> connector;
     // ev@3370e4dd-95f4-47a9-aaec-ea76f34a66c9:v1
 };
 
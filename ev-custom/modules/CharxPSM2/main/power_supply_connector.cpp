@@ -0,0 +1,591 @@
+#include "power_supply_connector.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+#include <everest/logging.hpp>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+PowerSupplyConnector::PowerSupplyConnector(PowerModuleBus& bus, power_supply_DCImplBase& impl, const Config& config) :
+    bus(bus), impl(impl), config(config), derating(bus.get_config().derating),
+    regulator(bus.get_config().regulation), stager(bus.get_config().staging) {
+    sent_module_setpoints.resize(bus.get_config().number_of_power_modules);
+    bus.add_connector(*this);
+    if (bus.get_reactor()) {
+        setpoint_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+}
+
+PowerSupplyConnector::~PowerSupplyConnector() {
+    if (setpoint_fd != -1) {
+        close(setpoint_fd);
+    }
+}
+
+void PowerSupplyConnector::start() {
+    EVLOG_info << "connector " << config.name << " ready";
+
+    update_capabilities(1);
+
+    // loop selection
+    auto& can = bus.get_can();
+    if (config.group_mode) {
+        can.get_executor().spawn(group_broadcast_loop(can));
+    } else {
+        can.get_executor().spawn(system_broadcast_loop(can));
+    }
+
+    if (auto* reactor = bus.get_reactor()) {
+        reactor->watch(setpoint_fd, EPOLLIN, [this](uint32_t) {
+            uint64_t tmp;
+            read(setpoint_fd, &tmp, sizeof(tmp));
+            start_setpoint_push();
+        });
+    }
+    started = true;
+}
+
+CanTask PowerSupplyConnector::system_broadcast_loop(CanSequence& can) {
+
+    // ensure power modules operational status is off
+    co_await can.set_state(false);
+
+    co_await run_periodic_tasks(can);
+}
+
+// Same tasks as the system mode, state, setpoint and telemetry are addressed to the group of the connector. The
+// modules of the group are known from their status, the first control cycle after that switches the group off.
+CanTask PowerSupplyConnector::group_broadcast_loop(CanSequence& can) {
+    co_await run_periodic_tasks(can);
+}
+
+CanTask PowerSupplyConnector::run_periodic_tasks(CanSequence& can) {
+    can.get_executor().spawn(telemetry_task(can));
+    co_await control_task(can);
+}
+
+// Setpoint path: operational readiness and system voltage/current. The PSM2 needs a control command every 50 ms
+// to 200 ms, this task is never refused by the bus budget, it only drains the budget of the others. Each cycle
+// sends what changed since the last one, or a keepalive when it is due.
+CanTask PowerSupplyConnector::control_task(CanSequence& can) {
+    const auto& bus_config = bus.get_config();
+    CycleScheduler scheduler(bus_config.control_period, bus_config.low_priority_budget);
+
+    while (true) {
+        co_await can.get_executor().sleep_until(scheduler.next_release());
+        scheduler.begin_cycle();
+
+        // a running send goes on with the newest values anyway
+        if (power_modules_ready and not setpoint_send_running) {
+            co_await send_setpoints(can);
+        } else if (not power_modules_ready) {
+            // modules that come back start from their defaults, send everything again
+            sent_setpoint = {};
+            std::fill(sent_module_setpoints.begin(), sent_module_setpoints.end(), SentSetpoint{});
+            regulator.reset();
+        }
+
+        scheduler.end_cycle();
+        bus.report_cycle(task_name("control"), scheduler);
+    }
+}
+
+// Output voltage and current of the connector
+CanTask PowerSupplyConnector::telemetry_task(CanSequence& can) {
+    const auto& bus_config = bus.get_config();
+    CycleScheduler scheduler(bus_config.telemetry_period, bus_config.low_priority_budget);
+
+    while (true) {
+        co_await can.get_executor().sleep_until(scheduler.next_release());
+        scheduler.begin_cycle();
+        bus.drain_received_frames();
+
+        if (not power_modules_ready) {
+            // nothing to read
+        } else if (not bus.get_budget().try_acquire(bus.broadcast_frames(), bus.control_frames())) {
+            scheduler.count_skipped_work();
+        } else {
+            // read voltage and current, publish them
+            EVLOG_info << "Reading voltage and current of connector " << config.name;
+            types::power_supply_DC::VoltageCurrent vc;
+            CanResult<VoltageCurrent> measured;
+            if (config.group_mode) {
+                co_await read_group_voltage_current(can, measured);
+            } else {
+                measured = co_await can.read_system_voltage_current();
+            }
+            log_status_on_fail("Reading system (voltage, current) error", measured.status);
+
+            // real values
+            vc.voltage_V = measured.value.voltage;
+            vc.current_A = measured.value.current;
+
+            EVLOG_info << "voltage: " << vc.voltage_V << "current: " << vc.current_A;
+            impl.publish_voltage_current(vc);
+
+            if (bus_config.current_regulation) {
+                regulate_current(measured);
+            }
+
+            // powermeter simulation
+            if (config.powermeter_simulated) {
+                if (power_modules_state) {
+                    bus.publish("everest/simulation/power_supply_DC/voltage", "\"" + std::to_string(voltage) + "\"");
+                    bus.publish("everest/simulation/power_supply_DC/current", "\"" + std::to_string(current) + "\"");
+                } else {
+                    bus.publish("everest/simulation/power_supply_DC/voltage", "\"0.0\"");
+                    bus.publish("everest/simulation/power_supply_DC/current", "\"0.0\"");
+                }
+            }
+        }
+
+        scheduler.end_cycle();
+        bus.report_cycle(task_name("telemetry"), scheduler);
+    }
+}
+
+// Output of the group: the modules are in parallel, their currents add up
+CanTask PowerSupplyConnector::read_group_voltage_current(CanSequence& can, CanResult<VoltageCurrent>& result) {
+    const auto values = co_await can.read_group_voltages_currents(config.group_id, group_members());
+
+    result = {values.status, {0, 0}};
+    for (const auto& value : values.value) {
+        if (value.status == CanBroker::AccessReturnType::SUCCESS) {
+            result.value.voltage = std::max(result.value.voltage, value.voltage);
+            result.value.current += value.current;
+        }
+    }
+}
+
+// The system mode follows the connection, a group is controlled once its modules reported their group number
+void PowerSupplyConnector::handle_status_sweep() {
+    if (not config.group_mode) {
+        power_modules_ready = bus.modules_connected();
+    } else {
+        power_modules_ready = bus.modules_connected() and not group_members().empty();
+        publish_group_status();
+    }
+
+    update_limits();
+}
+
+// Limits of the connector: derated for the hottest of its modules and scaled to the modules that answer, modules
+// that come back are added again. The capabilities and the module temperatures are published again when modules
+// come or go, or once the derating moved by more than the threshold.
+void PowerSupplyConnector::update_limits() {
+    const auto module_addresses = controlled_modules();
+    if (not power_modules_ready or module_addresses.empty()) {
+        return;
+    }
+
+    expected_modules = config.group_mode ? std::max(expected_modules, module_addresses.size())
+                                         : bus.get_config().number_of_power_modules;
+    const float share = static_cast<float>(module_addresses.size()) / std::max<std::size_t>(1, expected_modules);
+    const bool share_changed = share != module_share;
+    if (share_changed and share < 1) {
+        EVLOG_warning << fmt::format("Connector {} continues with {} of {} power modules", config.name,
+                                     module_addresses.size(), expected_modules);
+    } else if (share_changed) {
+        EVLOG_info << fmt::format("Connector {} runs with all {} power modules again", config.name, expected_modules);
+    }
+    module_share = share;
+
+    uint8_t temperature_max = 0;
+    for (const auto module_address : module_addresses) {
+        temperature_max = std::max(temperature_max, bus.get_module_state(module_address).temperature);
+    }
+    const float factor = derating.factor(temperature_max);
+    derating_factor = factor;
+
+    if (derating.needs_publish(factor)) {
+        EVLOG_info << fmt::format("Connector {} derated to {:.0f} % at {} C", config.name, factor * 100,
+                                  temperature_max);
+    }
+    if (share_changed or derating.needs_publish(factor)) {
+        update_capabilities(factor);
+        publish_temperatures(module_addresses);
+    }
+}
+
+void PowerSupplyConnector::update_capabilities(float factor) {
+    types::power_supply_DC::Capabilities caps;
+    caps.bidirectional = false;
+    caps.max_export_current_A = config.current_limit * factor * module_share;
+    caps.max_export_voltage_V = config.voltage_limit;
+    caps.min_export_current_A = 0;
+    caps.min_export_voltage_V = config.min_voltage_limit;
+    caps.max_export_power_W = config.power_limit * factor * module_share;
+    caps.current_regulation_tolerance_A = bus.get_config().regulation.tolerance;
+
+    impl.publish_capabilities(caps);
+    derating.published(factor);
+}
+
+// in the format of types/temperature.yaml
+void PowerSupplyConnector::publish_temperatures(const std::vector<uint8_t>& module_addresses) {
+    for (const auto module_address : module_addresses) {
+        const auto json =
+            fmt::format("{{\"temperature\":{},\"identification\":\"power_module_{}\",\"location\":\"{}\"}}",
+                        bus.get_module_state(module_address).temperature, module_address, config.name);
+        bus.publish(fmt::format("everest/charxpsm2/module/{}/temperature", module_address), json);
+    }
+}
+
+// modules whose last status reported the group of the connector, dead modules left out
+std::vector<uint8_t> PowerSupplyConnector::group_members() const {
+    std::vector<uint8_t> members;
+    for (uint8_t module_address = 0x00; module_address < bus.get_config().number_of_power_modules; module_address++) {
+        if (bus.get_module_state(module_address).group == config.group_id and bus.module_alive(module_address)) {
+            members.push_back(module_address);
+        }
+    }
+    return members;
+}
+
+// Members of the group and their highest temperature, published after each status sweep
+void PowerSupplyConnector::publish_group_status() {
+    const auto members = group_members();
+    uint8_t temperature_max = 0;
+    for (const auto module_address : members) {
+        temperature_max = std::max(temperature_max, bus.get_module_state(module_address).temperature);
+    }
+
+    const auto json = fmt::format("{{\"ready\":{},\"modules\":[{}],\"temperature_max_C\":{}}}",
+                                  power_modules_ready ? "true" : "false", fmt::join(members, ","), temperature_max);
+    bus.publish(fmt::format("everest/charxpsm2/group/{}/status", config.group_id), json);
+}
+
+// topics of further connectors are published below their implementation id
+std::string PowerSupplyConnector::task_name(const std::string& task) const {
+    return (config.name == "main") ? task : config.name + "/" + task;
+}
+
+// Operational readiness and system voltage/current, in the order the transition needs. Only the commands whose
+// value differs from the one the modules acknowledged go out. Without changes a single command keeps the modules
+// from reporting a CAN command interruption, readiness and setpoint take turns.
+CanTask PowerSupplyConnector::send_setpoint(CanSequence& can) {
+    const auto& bus_config = bus.get_config();
+    if (bus_config.module_staging) {
+        co_await send_staged_setpoint(can);
+        co_return;
+    }
+
+    const bool enable = power_modules_state;
+    const auto setpoint = apply_envelope(voltage, current);
+    const float voltage_setpoint = setpoint.voltage;
+    const float current_setpoint = setpoint.current;
+    const auto now = std::chrono::steady_clock::now();
+
+    bool send_state = not sent_setpoint.state_valid or sent_setpoint.state != enable;
+    bool send_values = not sent_setpoint.values_valid or sent_setpoint.voltage != voltage_setpoint or
+                       sent_setpoint.current != current_setpoint;
+    if (not send_state and not send_values) {
+        // due if the modules would go without a command until after the next control cycle otherwise
+        if (now + bus_config.control_period < last_setpoint_at + bus_config.setpoint_keepalive) {
+            co_return;
+        }
+        if (sent_setpoint.state_at <= sent_setpoint.values_at) {
+            send_state = true;
+        } else {
+            send_values = true;
+        }
+    }
+
+    bus.get_budget().acquire(bus.broadcast_frames() * ((send_state ? 1 : 0) + (send_values ? 1 : 0)));
+    last_setpoint_at = now;
+
+    const auto members = group_members();
+    const auto update_state = [&]() -> CanTask {
+        const auto status = config.group_mode ? co_await can.set_group_state(config.group_id, members, enable)
+                                              : co_await can.set_state(enable);
+        log_status_on_fail("Setting operational readiness error", status);
+        sent_setpoint.state_valid = status == CanBroker::AccessReturnType::SUCCESS;
+        sent_setpoint.state = enable;
+        sent_setpoint.state_at = now;
+    };
+    const auto update_values = [&]() -> CanTask {
+        const auto status =
+            config.group_mode
+                ? co_await can.set_group_voltage_current(config.group_id, members, voltage_setpoint, current_setpoint)
+                : co_await can.set_system_voltage_current(voltage_setpoint, current_setpoint);
+        log_status_on_fail("Setting system (voltage, current) error", status);
+        sent_setpoint.values_valid = status == CanBroker::AccessReturnType::SUCCESS;
+        sent_setpoint.voltage = voltage_setpoint;
+        sent_setpoint.current = current_setpoint;
+        sent_setpoint.values_at = now;
+    };
+
+    if (enable) {
+        // setpoint first, the modules must not start up with the previous one. An Off that came in meanwhile is
+        // sent next, the modules are not switched on for it.
+        if (send_values) {
+            co_await update_values();
+        }
+        if (send_state and power_modules_state) {
+            co_await update_state();
+        }
+    } else {
+        // switch off first, ramping down does not wait for the setpoint
+        if (send_state) {
+            co_await update_state();
+        }
+        if (send_values) {
+            co_await update_values();
+        }
+    }
+}
+
+// Module staging: readiness and setpoint go to each module, the staged modules share the current evenly and the
+// others are switched off. Modules that take over current are served before the ones that give it up, so the
+// output does not dip while the load moves. Each module gets a keepalive of its own.
+CanTask PowerSupplyConnector::send_staged_setpoint(CanSequence& can) {
+    const auto& bus_config = bus.get_config();
+    const bool enable = power_modules_state;
+    const auto setpoint = apply_envelope(voltage, current);
+    const float voltage_setpoint = setpoint.voltage;
+    const float current_setpoint = setpoint.current;
+    const auto now = std::chrono::steady_clock::now();
+
+    std::vector<ModuleStager::Candidate> candidates;
+    for (const auto module_address : controlled_modules()) {
+        candidates.push_back({module_address, bus.get_module_state(module_address).temperature});
+    }
+    const auto stage_changes = stager.get_stage_changes();
+    const auto staged = stager.update(enable, voltage_setpoint * current_setpoint, candidates, now);
+    if (stager.get_stage_changes() != stage_changes) {
+        publish_staging(voltage_setpoint * current_setpoint);
+    }
+    const float module_current = staged.empty() ? 0 : current_setpoint / staged.size();
+
+    struct ModuleCommand {
+        uint8_t module_address;
+        bool enable;
+        bool send_state;
+        bool send_values;
+    };
+    std::vector<ModuleCommand> raising;
+    std::vector<ModuleCommand> lowering;
+    for (const auto& candidate : candidates) {
+        const auto& sent = sent_module_setpoints[candidate.module_address];
+        ModuleCommand command{candidate.module_address,
+                              std::find(staged.begin(), staged.end(), candidate.module_address) != staged.end(), false,
+                              false};
+        command.send_state = not sent.state_valid or sent.state != command.enable;
+        command.send_values = command.enable and (not sent.values_valid or sent.voltage != voltage_setpoint or
+                                                  sent.current != module_current);
+        if (not command.send_state and not command.send_values) {
+            // due if the module would go without a command until after the next control cycle otherwise
+            if (now + bus_config.control_period < std::max(sent.state_at, sent.values_at) + bus_config.setpoint_keepalive) {
+                continue;
+            }
+            if (command.enable and sent.state_at > sent.values_at) {
+                command.send_values = true;
+            } else {
+                command.send_state = true;
+            }
+        }
+
+        const bool raises = command.enable and (not sent.state or not sent.values_valid or module_current >= sent.current);
+        (raises ? raising : lowering).push_back(command);
+    }
+    if (raising.empty() and lowering.empty()) {
+        co_return;
+    }
+    last_setpoint_at = now;
+
+    for (const auto& commands : {raising, lowering}) {
+        for (const auto& command : commands) {
+            // an Off that came in meanwhile is sent next, no module is switched on for it
+            if (command.enable and not power_modules_state) {
+                co_return;
+            }
+            auto& sent = sent_module_setpoints[command.module_address];
+            bus.get_budget().acquire(PowerModuleBus::UNICAST_FRAMES *
+                                     ((command.send_state ? 1 : 0) + (command.send_values ? 1 : 0)));
+
+            // setpoint first when switching on, the module must not start up with the previous one
+            if (command.send_values) {
+                const auto status = co_await can.set_module_voltage_current(command.module_address, voltage_setpoint,
+                                                                            module_current);
+                log_status_on_fail("Setting voltage, current of power module " +
+                                       std::to_string(command.module_address) + " error",
+                                   status);
+                sent.values_valid = status == CanBroker::AccessReturnType::SUCCESS;
+                sent.voltage = voltage_setpoint;
+                sent.current = module_current;
+                sent.values_at = now;
+            }
+            if (command.send_state) {
+                const auto status = co_await can.set_module_state(command.module_address, command.enable);
+                log_status_on_fail("Setting operational readiness of power module " +
+                                       std::to_string(command.module_address) + " error",
+                                   status);
+                sent.state_valid = status == CanBroker::AccessReturnType::SUCCESS;
+                sent.state = command.enable;
+                sent.state_at = now;
+            }
+        }
+    }
+}
+
+// modules of the connector: its group in group mode, all modules otherwise, dead modules left out
+std::vector<uint8_t> PowerSupplyConnector::controlled_modules() const {
+    if (config.group_mode) {
+        return group_members();
+    }
+    std::vector<uint8_t> candidates;
+    for (uint8_t module_address = 0x00; module_address < bus.get_config().number_of_power_modules; module_address++) {
+        if (bus.module_alive(module_address)) {
+            candidates.push_back(module_address);
+        }
+    }
+    return candidates;
+}
+
+// the staged modules, published on every change
+void PowerSupplyConnector::publish_staging(float power) {
+    const auto& staged = stager.get_active();
+    const auto json = fmt::format("{{\"power_W\":{:.0f},\"modules\":[{}],\"stage_changes\":{}}}", power,
+                                  fmt::join(staged, ","), stager.get_stage_changes());
+    bus.publish("everest/charxpsm2/" + task_name("staging"), json);
+    EVLOG_info << "Connector " << config.name << " staged power modules: " << json;
+}
+
+// Outer current loop on the measured output, the trim is added to the current setpoint with the next command
+void PowerSupplyConnector::regulate_current(const CanResult<VoltageCurrent>& measured) {
+    if (not power_modules_state or measured.status != CanBroker::AccessReturnType::SUCCESS) {
+        regulator.reset();
+        return;
+    }
+
+    const float voltage_setpoint = voltage;
+    const float current_limit = envelope_current_limit(voltage_setpoint);
+    const float target = std::min<float>(current, current_limit);
+    // at its voltage setpoint the output delivers less current than requested, that is not an error of the loop
+    const bool voltage_limited = measured.value.voltage >= voltage_setpoint * VOLTAGE_LIMITED_SHARE and
+                                 measured.value.current < target;
+    // the command sits at the envelope, a larger trim would not go out
+    const bool envelope_limited = current + regulator.get_trim() >= current_limit;
+    regulator.update(target, measured.value.current, voltage_limited or envelope_limited,
+                     std::chrono::steady_clock::now());
+
+    if (bus.get_config().debug_print_all_telemetry) {
+        EVLOG_info << fmt::format("Connector {} current regulation: target {:.2f} A, error {:.2f} A{}, trim {:.2f} A",
+                                  config.name, target, regulator.get_error(),
+                                  regulator.within_tolerance() ? " (within tolerance)" : "", regulator.get_trim());
+    }
+}
+
+// Constant power envelope: the current is limited to the lowest of the configured current limit, the rated current of
+// the modules that answer, that current at the thermal derating and the derated power limit at the requested voltage.
+// The effective limit is published with the candidate that binds whenever it moves.
+VoltageCurrent PowerSupplyConnector::apply_envelope(float voltage, float current) {
+    // the trim of the current regulation is added first, the envelope holds for the command that goes out
+    return {voltage, std::clamp(current + regulator.get_trim(), 0.0f, envelope_current_limit(voltage))};
+}
+
+float PowerSupplyConnector::envelope_current_limit(float voltage) {
+    // the modules that answer at their derated rating, as in the published capabilities
+    const float capacity = module_share * derating_factor;
+    struct Candidate {
+        float current_limit;
+        const char* limited_by;
+    };
+    // on a tie the earlier candidate is reported
+    const std::array<Candidate, 4> candidates{{
+        {config.current_limit, "current"},
+        {config.current_limit * module_share, "modules"},
+        {config.current_limit * capacity, "thermal"},
+        {config.power_limit * capacity / std::max(voltage, config.min_voltage_limit), "power"},
+    }};
+    const auto binding = std::min_element(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) {
+        return a.current_limit < b.current_limit;
+    });
+    const float current_limit = binding->current_limit;
+    const char* limited_by = binding->limited_by;
+
+    if (std::abs(current_limit - published_current_limit) > ENVELOPE_PUBLISH_THRESHOLD) {
+        publish_envelope(voltage, current_limit, limited_by);
+    }
+    return current_limit;
+}
+
+void PowerSupplyConnector::publish_envelope(float voltage, float current_limit, const char* limited_by) {
+    published_current_limit = current_limit;
+    const auto json = fmt::format("{{\"voltage_V\":{:.1f},\"current_limit_A\":{:.2f},\"power_limit_W\":{:.0f},"
+                                  "\"limited_by\":\"{}\"}}",
+                                  voltage, current_limit, voltage * current_limit, limited_by);
+    bus.publish("everest/charxpsm2/" + task_name("envelope"), json);
+    EVLOG_info << "Connector " << config.name << " envelope: " << json;
+}
+
+// The only path to send_setpoint, for the control cycle and for changes pushed by the command handlers. One send
+// is in flight at a time: changes that come in meanwhile are sent right after it, by the same coroutine, so a
+// suspended send cannot overtake a newer mode or setpoint.
+CanTask PowerSupplyConnector::send_setpoints(CanSequence& can) {
+    setpoint_send_running = true;
+    do {
+        setpoint_pending = false;
+        co_await can.get_executor().sleep_until(last_setpoint_at + bus.get_config().setpoint_min_spacing);
+        co_await send_setpoint(can);
+    } while (setpoint_pending and power_modules_ready);
+    setpoint_send_running = false;
+
+    if (not power_modules_ready) {
+        setpoint_pending = false;
+    }
+}
+
+// executor thread, a running send picks the change up when it finished. While the modules are not ready the change
+// is dropped, the first control cycle after they are back sends everything again, and notify_setpoint() must not
+// find the flag still set.
+void PowerSupplyConnector::start_setpoint_push() {
+    if (not power_modules_ready) {
+        setpoint_pending = false;
+        return;
+    }
+    if (not setpoint_send_running) {
+        bus.get_can().get_executor().spawn(send_setpoints(bus.get_can()));
+    }
+}
+
+// called by the command handlers
+void PowerSupplyConnector::notify_setpoint() {
+    // a push that is already pending sends the newest values
+    if (not started or setpoint_pending.exchange(true)) {
+        return;
+    }
+
+    if (setpoint_fd != -1) {
+        uint64_t value = 1;
+        write(setpoint_fd, &value, sizeof(value));
+    } else {
+        bus.get_can().get_executor().post([this]() { start_setpoint_push(); });
+    }
+}
+
+// Voltages outside the range are moved to its edge instead of leaving the previous setpoint in place, the current
+// is limited when the setpoint is sent
+void PowerSupplyConnector::set_export_voltage_current(double voltage, double current) {
+    const double applied_voltage = std::clamp<double>(voltage, config.min_voltage_limit, config.voltage_limit);
+    const double applied_current = std::max(current, 0.0);
+    if (applied_voltage != voltage or applied_current != current) {
+        EVLOG_warning << fmt::format("Out of range voltage/current settings clamped: {}V / {}A to {}V / {}A", voltage,
+                                     current, applied_voltage, applied_current);
+    }
+
+    EVLOG_info << "EXPORT--- " << config.name;
+    this->voltage = applied_voltage;
+    this->current = applied_current;
+    notify_setpoint();
+}
+
+void PowerSupplyConnector::set_mode(bool enabled) {
+    power_modules_state = enabled;
+    notify_setpoint();
+}
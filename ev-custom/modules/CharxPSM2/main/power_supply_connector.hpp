@@ -0,0 +1,124 @@
+#ifndef Charx_PSM2_POWER_SUPPLY_CONNECTOR_HPP
+#define Charx_PSM2_POWER_SUPPLY_CONNECTOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <generated/interfaces/power_supply_DC/Implementation.hpp>
+
+#include "power_module_bus.hpp"
+
+// One power_supply_DC implementation: the mode and setpoint of a connector, sent to its power module group, and
+// the voltage, current and capabilities published for it. The connectors of a dispenser share one PowerModuleBus.
+class PowerSupplyConnector {
+public:
+    struct Config {
+        std::string name; // implementation id, "main" keeps the topics of a single connector dispenser
+        bool group_mode{false}; // system broadcast otherwise, only for a single connector
+        uint8_t group_id{0};
+        float current_limit{0};
+        float voltage_limit{0};
+        float power_limit{0};
+        float min_voltage_limit{50.};
+        bool powermeter_simulated{false};
+    };
+
+    PowerSupplyConnector(PowerModuleBus& bus, power_supply_DCImplBase& impl, const Config& config);
+    PowerSupplyConnector(const PowerSupplyConnector&) = delete;
+    PowerSupplyConnector& operator=(const PowerSupplyConnector&) = delete;
+    ~PowerSupplyConnector();
+
+    // Publishes the capabilities and spawns the tasks of the connector, before PowerModuleBus::run()
+    void start();
+
+    // command handlers, any thread
+    void set_mode(bool enabled);
+    void set_export_voltage_current(double voltage, double current);
+
+    // executor thread, after each status sweep of the bus
+    void handle_status_sweep();
+
+private:
+    CanTask system_broadcast_loop(CanSequence& can);
+    CanTask group_broadcast_loop(CanSequence& can);
+    CanTask run_periodic_tasks(CanSequence& can);
+    CanTask control_task(CanSequence& can);
+    CanTask telemetry_task(CanSequence& can);
+    CanTask read_group_voltage_current(CanSequence& can, CanResult<VoltageCurrent>& result);
+    std::vector<uint8_t> group_members() const;
+    void publish_group_status();
+    std::string task_name(const std::string& task) const;
+
+    void update_limits();
+    void update_capabilities(float factor);
+    void publish_temperatures(const std::vector<uint8_t>& module_addresses);
+    void regulate_current(const CanResult<VoltageCurrent>& measured);
+    VoltageCurrent apply_envelope(float voltage, float current);
+    float envelope_current_limit(float voltage);
+    void publish_envelope(float voltage, float current_limit, const char* limited_by);
+
+    CanTask send_setpoints(CanSequence& can);
+    CanTask send_setpoint(CanSequence& can);
+    CanTask send_staged_setpoint(CanSequence& can);
+    std::vector<uint8_t> controlled_modules() const;
+    void publish_staging(float power);
+    void notify_setpoint();
+    void start_setpoint_push();
+
+    PowerModuleBus& bus;
+    power_supply_DCImplBase& impl;
+    const Config config;
+
+    std::atomic<bool> power_modules_state{false};
+    // setpoint as requested, the envelope is applied when it is sent
+    std::atomic<float> voltage{0};
+    std::atomic<float> current{0};
+
+    // Share of the current and power limits left by the thermal derating, part of the envelope
+    ThermalDerating derating;
+    std::atomic<float> derating_factor{1};
+
+    // Share of the expected modules that answer, the limits shrink with it while modules are missing (executor
+    // thread). The expected modules of a group are the most that ever reported the group.
+    float module_share{1};
+    std::size_t expected_modules{0};
+    // effective current limit published last, executor thread only
+    constexpr static float ENVELOPE_PUBLISH_THRESHOLD = 0.1; // A
+    float published_current_limit{-1};
+
+    bool power_modules_ready{false};
+
+    // Setpoint and mode changes are pushed at once while the modules are ready. The command handlers hand them
+    // to the executor thread, in reactor mode through setpoint_fd.
+    int setpoint_fd{-1};
+    std::atomic<bool> setpoint_pending{false};
+    std::atomic<bool> started{false};
+    bool setpoint_send_running{false};
+    std::chrono::steady_clock::time_point last_setpoint_at{};
+
+    // Values the modules acknowledged last, executor thread only. Invalid after a failed command or while the
+    // modules are not ready, so they are sent again.
+    struct SentSetpoint {
+        bool state_valid{false};
+        bool state{false};
+        std::chrono::steady_clock::time_point state_at{};
+        bool values_valid{false};
+        float voltage{0};
+        float current{0};
+        std::chrono::steady_clock::time_point values_at{};
+    };
+    SentSetpoint sent_setpoint;
+
+    // Trim of the current setpoint, zero without current regulation
+    constexpr static float VOLTAGE_LIMITED_SHARE = 0.99; // of the voltage setpoint, above the output runs at it
+    CurrentRegulator regulator;
+
+    // Module staging: the same per module, indexed by module address
+    ModuleStager stager;
+    std::vector<SentSetpoint> sent_module_setpoints;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "reactor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <everest/logging.hpp>
+
+// Helper function to throw an exception with an error message and errno description
+static void throw_with_error(const std::string& msg) {
+    throw std::runtime_error(msg + ": (" + std::string(strerror(errno)) + ")");
+}
+
+static struct timespec to_timespec(std::chrono::nanoseconds duration) {
+    struct timespec ts;
+    ts.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(duration).count();
+    ts.tv_nsec = (duration % std::chrono::seconds(1)).count();
+    return ts;
+}
+
+Reactor::Reactor() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        throw_with_error("Failed with epoll_create1");
+    }
+
+    // wakes the reactor for stop() and for work handed over from other threads
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        throw_with_error("Failed to create reactor eventfd");
+    }
+    watch(wake_fd, EPOLLIN, [this](uint32_t) {
+        uint64_t tmp;
+        read(wake_fd, &tmp, sizeof(tmp));
+    });
+}
+
+Reactor::~Reactor() {
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+void Reactor::watch(int fd, uint32_t events, Handler handler) {
+    struct epoll_event event {};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        throw_with_error("Failed with epoll_ctl/EPOLL_CTL_ADD");
+    }
+    handlers[fd] = std::move(handler);
+}
+
+void Reactor::modify(int fd, uint32_t events) {
+    struct epoll_event event {};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1) {
+        EVLOG_error << "Failed with epoll_ctl/EPOLL_CTL_MOD: (" << strerror(errno) << ")";
+    }
+}
+
+void Reactor::unwatch(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    handlers.erase(fd);
+}
+
+void Reactor::add_round_hook(RoundHook hook) {
+    round_hooks.push_back(std::move(hook));
+}
+
+void Reactor::run() {
+    reactor_thread = std::this_thread::get_id();
+    std::array<struct epoll_event, MAX_EVENTS> events;
+
+    while (not stop_requested) {
+        // hooks hand work to each other (sequence -> broker -> sequence), run them until all are idle
+        bool busy = true;
+        while (busy and not stop_requested) {
+            busy = false;
+            for (const auto& hook : round_hooks) {
+                busy = hook() or busy;
+            }
+        }
+        if (stop_requested) {
+            break;
+        }
+
+        const auto ready = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+        if (ready == -1) {
+            if (errno != EINTR) {
+                EVLOG_error << "Failed with epoll_wait: (" << strerror(errno) << ")";
+            }
+            continue;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            // a handler may unwatch another descriptor of this round or its own, it runs from a copy that outlives
+            // the erase
+            const auto entry = handlers.find(events[i].data.fd);
+            if (entry != handlers.end()) {
+                const auto handler = entry->second;
+                handler(events[i].events);
+            }
+        }
+    }
+
+    reactor_thread = std::thread::id{};
+}
+
+void Reactor::stop() {
+    stop_requested = true;
+    wake();
+}
+
+void Reactor::wake() {
+    uint64_t value = 1;
+    write(wake_fd, &value, sizeof(value));
+}
+
+bool Reactor::in_reactor_thread() const {
+    return reactor_thread.load() == std::this_thread::get_id();
+}
+
+TimerFd::TimerFd() {
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        throw_with_error("Failed with timerfd_create");
+    }
+}
+
+TimerFd::~TimerFd() {
+    close(fd);
+}
+
+void TimerFd::arm_at(std::chrono::steady_clock::time_point time) {
+    if (time == std::chrono::steady_clock::time_point::max()) {
+        disarm();
+        return;
+    }
+
+    struct itimerspec spec {};
+    // zero would disarm the timer, a deadline in the past expires at once
+    spec.it_value = to_timespec(std::max(time.time_since_epoch(), std::chrono::steady_clock::duration(1)));
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void TimerFd::arm_periodic(std::chrono::steady_clock::time_point start, std::chrono::nanoseconds period) {
+    struct itimerspec spec {};
+    spec.it_value = to_timespec(std::max(start.time_since_epoch(), std::chrono::steady_clock::duration(1)));
+    spec.it_interval = to_timespec(period);
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void TimerFd::disarm() {
+    struct itimerspec spec {};
+    timerfd_settime(fd, 0, &spec, nullptr);
+}
+
+uint64_t TimerFd::read_expirations() {
+    uint64_t expirations = 0;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return 0;
+    }
+    return expirations;
+}
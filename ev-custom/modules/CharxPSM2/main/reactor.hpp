@@ -0,0 +1,77 @@
+#ifndef Charx_PSM2_REACTOR_HPP
+#define Charx_PSM2_REACTOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+
+// Single threaded event loop: one epoll instance multiplexes every file descriptor of the module, so the CAN
+// broker, the command sequences and the setpoint updates run on one thread without handing work to each other.
+class Reactor {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+    // Runs after every round of file descriptor handlers, returns true if it did some work. The hooks are called
+    // again until none of them has work left, only then the reactor sleeps in epoll_wait.
+    using RoundHook = std::function<bool()>;
+
+    Reactor();
+    ~Reactor();
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // reactor thread only, or before run()
+    void watch(int fd, uint32_t events, Handler handler);
+    void modify(int fd, uint32_t events);
+    void unwatch(int fd);
+    void add_round_hook(RoundHook hook);
+
+    // Dispatch events until stop() was called
+    void run();
+
+    // thread safe
+    void stop();
+    void wake();
+    bool in_reactor_thread() const;
+
+private:
+    constexpr static int MAX_EVENTS = 16;
+
+    int epoll_fd{-1};
+    int wake_fd{-1};
+    std::map<int, Handler> handlers;
+    std::vector<RoundHook> round_hooks;
+    std::atomic<bool> stop_requested{false};
+    std::atomic<std::thread::id> reactor_thread{};
+};
+
+// timerfd on CLOCK_MONOTONIC, the clock of std::chrono::steady_clock
+class TimerFd {
+public:
+    TimerFd();
+    ~TimerFd();
+    TimerFd(const TimerFd&) = delete;
+    TimerFd& operator=(const TimerFd&) = delete;
+
+    // expire once at an absolute time, time_point::max() disarms
+    void arm_at(std::chrono::steady_clock::time_point time);
+    // expire every period, the first time at start
+    void arm_periodic(std::chrono::steady_clock::time_point start, std::chrono::nanoseconds period);
+    void disarm();
+    // number of expirations since the last read, 0 if none
+    uint64_t read_expirations();
+
+    int get_fd() const {
+        return fd;
+    }
+
+private:
+    int fd{-1};
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "rtt_estimator.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void RttEstimator::add_sample(std::chrono::nanoseconds rtt) {
+    samples[next] = std::max(rtt, std::chrono::nanoseconds(0));
+    next = (next + 1) % WINDOW_SIZE;
+    count = std::min(count + 1, WINDOW_SIZE);
+    update_quantile();
+}
+
+bool RttEstimator::has_estimate() const {
+    return count >= MIN_SAMPLES;
+}
+
+std::chrono::nanoseconds RttEstimator::p99() const {
+    return quantile;
+}
+
+std::chrono::milliseconds RttEstimator::timeout(const Config& config) const {
+    if (not has_estimate()) {
+        return config.ceiling;
+    }
+
+    const auto scaled = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::duration<double, std::nano>(quantile.count() * config.safety_factor));
+    return std::clamp(scaled + std::chrono::milliseconds(1), config.floor, config.ceiling);
+}
+
+void RttEstimator::update_quantile() {
+    std::array<std::chrono::nanoseconds, WINDOW_SIZE> sorted;
+    std::copy_n(samples.begin(), count, sorted.begin());
+
+    const auto index = std::min(count - 1, static_cast<std::size_t>(std::ceil(QUANTILE * count)) - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.begin() + count);
+    quantile = sorted[index];
+}
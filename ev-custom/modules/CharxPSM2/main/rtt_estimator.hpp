@@ -0,0 +1,40 @@
+#ifndef Charx_PSM2_RTT_ESTIMATOR_HPP
+#define Charx_PSM2_RTT_ESTIMATOR_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+
+// Round trip times of the last WINDOW_SIZE responses of one command/destination, the timeout is derived from a
+// high quantile of them.
+class RttEstimator {
+public:
+    struct Config {
+        std::chrono::milliseconds floor{20};
+        std::chrono::milliseconds ceiling{200};
+        double safety_factor{3.0};
+    };
+
+    constexpr static std::size_t WINDOW_SIZE = 64;
+    constexpr static std::size_t MIN_SAMPLES = 8; // below this the ceiling is used
+    constexpr static double QUANTILE = 0.99;
+
+    void add_sample(std::chrono::nanoseconds rtt);
+
+    bool has_estimate() const;
+    std::chrono::nanoseconds p99() const;
+
+    // p99 * safety factor, limited to [floor, ceiling]; the ceiling as long as there is no estimate
+    std::chrono::milliseconds timeout(const Config& config) const;
+
+private:
+    void update_quantile();
+
+    std::array<std::chrono::nanoseconds, WINDOW_SIZE> samples{};
+    std::size_t count{0};
+    std::size_t next{0};
+    std::chrono::nanoseconds quantile{0};
+};
+
+#endif
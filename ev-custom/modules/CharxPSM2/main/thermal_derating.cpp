@@ -0,0 +1,31 @@
+#include "thermal_derating.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+ThermalDerating::ThermalDerating(const Config& config) : config(config) {
+}
+
+float ThermalDerating::factor(float temperature) const {
+    const float min_factor = std::clamp(config.min_factor, 0.0f, 1.0f);
+    if (temperature <= config.start_temperature) {
+        return 1;
+    }
+    if (temperature >= config.end_temperature) {
+        return min_factor;
+    }
+
+    const float x = (temperature - config.start_temperature) / (config.end_temperature - config.start_temperature);
+    const float smooth = x * x * (3 - 2 * x);
+    return 1 - (1 - min_factor) * smooth;
+}
+
+bool ThermalDerating::needs_publish(float factor) const {
+    // the ends of the curve are always published, the limits must not stay slightly derated once cool again
+    const bool at_end = factor == 1 or factor == std::clamp(config.min_factor, 0.0f, 1.0f);
+    return std::abs(factor - published_factor) > config.republish_threshold or (at_end and factor != published_factor);
+}
+
+void ThermalDerating::published(float factor) {
+    published_factor = factor;
+}
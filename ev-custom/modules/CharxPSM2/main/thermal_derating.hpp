@@ -0,0 +1,30 @@
+#ifndef Charx_PSM2_THERMAL_DERATING_HPP
+#define Charx_PSM2_THERMAL_DERATING_HPP
+
+// Derating curve of the output limits over the hottest module temperature. Full output up to start_temperature,
+// min_factor from end_temperature on and a smoothstep in between, so the limits start to move gently well before
+// the modules trip on their own over-temperature protection.
+class ThermalDerating {
+public:
+    struct Config {
+        float start_temperature{60}; // C
+        float end_temperature{80};   // C
+        float min_factor{0.2};       // share of the limits left at end_temperature
+        float republish_threshold{0.05}; // change of the factor that is published
+    };
+
+    explicit ThermalDerating(const Config& config);
+
+    // share of the current and power limits at the temperature, 1 is no derating
+    float factor(float temperature) const;
+
+    // true if the factor moved by more than the threshold since the last published one, or reached an end
+    bool needs_publish(float factor) const;
+    void published(float factor);
+
+private:
+    const Config config;
+    float published_factor{-1};
+};
+
+#endif
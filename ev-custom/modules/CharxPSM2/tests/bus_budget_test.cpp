@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "bus_budget.hpp"
+
+using namespace std::chrono_literals;
+
+// 1 frame per second refills too slowly to matter within a test
+TEST(BusBudget, RefusesFramesBeyondTheBurst) {
+    BusBudget budget(1, 10);
+    EXPECT_TRUE(budget.try_acquire(8));
+    EXPECT_FALSE(budget.try_acquire(3));
+    EXPECT_TRUE(budget.try_acquire(2));
+    EXPECT_FALSE(budget.try_acquire(1));
+    EXPECT_EQ(budget.get_refused(), 2u);
+}
+
+TEST(BusBudget, LowerPriorityLeavesTheReserve) {
+    BusBudget budget(1, 10);
+    EXPECT_FALSE(budget.try_acquire(6, 5));
+    EXPECT_TRUE(budget.try_acquire(5, 5));
+    // the reserve is left for work without one
+    EXPECT_FALSE(budget.try_acquire(1, 5));
+    EXPECT_TRUE(budget.try_acquire(5));
+}
+
+TEST(BusBudget, AcquireOverdrawsTheBucket) {
+    BusBudget budget(1, 10);
+    budget.acquire(15);
+    EXPECT_FALSE(budget.try_acquire(0));
+    EXPECT_EQ(budget.get_refused(), 1u);
+}
+
+TEST(BusBudget, RefillsUpToTheBurst) {
+    BusBudget budget(100, 10);
+    EXPECT_TRUE(budget.try_acquire(10));
+    std::this_thread::sleep_for(150ms);
+    // 15 frames worth of time, the bucket holds 10
+    EXPECT_TRUE(budget.try_acquire(10));
+    EXPECT_FALSE(budget.try_acquire(5));
+}
+
+TEST(BusBudget, LimitsRateAndBurst) {
+    BusBudget budget(0, 0);
+    EXPECT_TRUE(budget.try_acquire(1));
+    EXPECT_FALSE(budget.try_acquire(1));
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include "charxpsm2_protocol.hpp"
+
+namespace charx = can::protocol::charxpsm2;
+
+namespace {
+
+constexpr uint8_t MONITOR_ID = 0xF0;
+
+// what the kernel does with a raw CAN socket filter
+bool passes(const std::vector<struct can_filter>& filters, canid_t can_id) {
+    for (const auto& filter : filters) {
+        if ((can_id & filter.can_mask) == (filter.can_id & filter.can_mask)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+canid_t frame_id(uint8_t source, uint8_t destination, charx::def::Command command,
+                 uint8_t device_no = charx::def::DEVICE_NO) {
+    struct can_frame frame {};
+    charx::set_header(frame, source, destination, command, device_no);
+    return frame.can_id;
+}
+
+} // namespace
+
+TEST(ResponseFilters, PassAnswersOfAnyModuleToTheMonitor) {
+    const auto filters = charx::response_filters(MONITOR_ID);
+    for (const uint8_t module_address : {0x00, 0x05, 0x3E}) {
+        EXPECT_TRUE(passes(filters, frame_id(module_address, MONITOR_ID, charx::def::Command::MODULE_READ_STATUS)));
+        EXPECT_TRUE(passes(filters, frame_id(module_address, MONITOR_ID,
+                                             charx::def::Command::SET_MODULE_OUTPUT_VOLTAGE_AND_CURRENT)));
+    }
+}
+
+TEST(ResponseFilters, PassAnswersToGroupCommands) {
+    const auto filters = charx::response_filters(MONITOR_ID);
+    EXPECT_TRUE(passes(filters, frame_id(0x05, MONITOR_ID, charx::def::Command::SYSTEM_READ_ACTUAL_VALUES,
+                                         charx::def::DEVICE_NO_GROUP)));
+}
+
+TEST(ResponseFilters, PassErrorResponses) {
+    const auto filters = charx::response_filters(MONITOR_ID);
+    const auto error_code = static_cast<canid_t>(charx::def::ErrorCode::COMMAND_INVALID);
+    const auto can_id = frame_id(0x05, MONITOR_ID, charx::def::Command::MODULE_READ_STATUS) |
+                        (error_code << charx::def::ERROR_CODE_BIT_SHIFT);
+    EXPECT_TRUE(passes(filters, can_id));
+}
+
+TEST(ResponseFilters, DropOtherTraffic) {
+    const auto filters = charx::response_filters(MONITOR_ID);
+    // addressed to another monitor
+    EXPECT_FALSE(passes(filters, frame_id(0x05, 0xF1, charx::def::Command::MODULE_READ_STATUS)));
+    // our own request to a module
+    EXPECT_FALSE(passes(filters, frame_id(MONITOR_ID, 0x05, charx::def::Command::MODULE_READ_STATUS)));
+    // another device number
+    EXPECT_FALSE(passes(filters, frame_id(0x05, MONITOR_ID, charx::def::Command::MODULE_READ_STATUS, 0x01)));
+    // standard frame and remote request with otherwise matching bits
+    const auto can_id = frame_id(0x05, MONITOR_ID, charx::def::Command::MODULE_READ_STATUS);
+    EXPECT_FALSE(passes(filters, can_id & CAN_EFF_MASK));
+    EXPECT_FALSE(passes(filters, can_id | CAN_RTR_FLAG));
+}
+
+TEST(EchoFilter, PassesOnlyOwnFrames) {
+    const std::vector<struct can_filter> filters{charx::echo_filter(MONITOR_ID)};
+    EXPECT_TRUE(passes(filters, frame_id(MONITOR_ID, 0x05, charx::def::Command::MODULE_READ_STATUS)));
+    EXPECT_TRUE(passes(filters, frame_id(MONITOR_ID, 0x01, charx::def::Command::SYSTEM_READ_ACTUAL_VALUES,
+                                         charx::def::DEVICE_NO_GROUP)));
+    EXPECT_FALSE(passes(filters, frame_id(0x05, MONITOR_ID, charx::def::Command::MODULE_READ_STATUS)));
+}
+
+TEST(RequestKey, TellsCommandsPeersAndGroupsApart) {
+    const auto command = static_cast<uint8_t>(charx::def::Command::MODULE_READ_STATUS);
+    const auto other_command = static_cast<uint8_t>(charx::def::Command::MODULE_READ_ACTUAL_VALUES);
+    EXPECT_NE(charx::request_key(command, 0x05), charx::request_key(other_command, 0x05));
+    EXPECT_NE(charx::request_key(command, 0x05), charx::request_key(command, 0x06));
+    // group 1 and module 1 are different peers
+    EXPECT_NE(charx::request_key(command, 0x01), charx::request_key(command, 0x01, true));
+}
+
+TEST(RequestKey, OfAFrameIsTheKeyOfItsDestination) {
+    struct can_frame frame {};
+    charx::prepare_frame(frame, MONITOR_ID, 0x05, charx::def::Command::MODULE_READ_STATUS, {});
+    const auto key = charx::request_key(frame);
+    EXPECT_EQ(key, charx::request_key(static_cast<uint8_t>(charx::def::Command::MODULE_READ_STATUS), 0x05));
+
+    // the module answers with its address as source, the broker looks the request up by that
+    const auto answer = frame_id(0x05, MONITOR_ID, charx::def::Command::MODULE_READ_STATUS);
+    EXPECT_EQ(key, charx::request_key(charx::get_command(answer), charx::get_source(answer)));
+
+    charx::prepare_group_frame(frame, MONITOR_ID, 0x01, charx::def::Command::SYSTEM_READ_ACTUAL_VALUES, {});
+    EXPECT_EQ(charx::request_key(frame),
+              charx::request_key(static_cast<uint8_t>(charx::def::Command::SYSTEM_READ_ACTUAL_VALUES), 0x01, true));
+}
@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include "current_regulator.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+const CurrentRegulator::Config config{250ms, 0.2, 1.0, 5, 0.5};
+const auto start = CurrentRegulator::Clock::time_point{} + 1h;
+
+} // namespace
+
+TEST(CurrentRegulator, TrimsTheSteadyStateError) {
+    CurrentRegulator regulator(config);
+    regulator.update(100, 98, false, start);
+    EXPECT_FLOAT_EQ(regulator.get_error(), 2);
+    // 0.2 * 2 A proportional, 1/s * 2 A * 0.25 s integral
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0.9);
+
+    regulator.update(100, 99, false, start + 250ms);
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0.2 + 0.5 + 0.25);
+}
+
+TEST(CurrentRegulator, UpdatesAtMostOncePerPeriod) {
+    CurrentRegulator regulator(config);
+    regulator.update(100, 98, false, start);
+    regulator.update(100, 90, false, start + 100ms);
+    EXPECT_FLOAT_EQ(regulator.get_error(), 2);
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0.9);
+}
+
+TEST(CurrentRegulator, LeavesErrorsWithinTheDeadbandAlone) {
+    CurrentRegulator regulator(config);
+    regulator.update(100, 98, false, start);
+    const float trim = regulator.get_trim();
+
+    regulator.update(100, 99.7, false, start + 250ms);
+    EXPECT_TRUE(regulator.within_tolerance());
+    EXPECT_FLOAT_EQ(regulator.get_trim(), trim);
+    regulator.update(100, 100.4, false, start + 500ms);
+    EXPECT_FLOAT_EQ(regulator.get_trim(), trim);
+}
+
+TEST(CurrentRegulator, HoldsTheTrimWhileRamping) {
+    CurrentRegulator regulator(config);
+    regulator.update(100, 98, false, start);
+    const float trim = regulator.get_trim();
+
+    // an error above max_trim is a ramp, not a steady state error
+    regulator.update(150, 100, false, start + 250ms);
+    EXPECT_FALSE(regulator.within_tolerance());
+    EXPECT_FLOAT_EQ(regulator.get_trim(), trim);
+}
+
+TEST(CurrentRegulator, StartsOverWhileLimited) {
+    CurrentRegulator regulator(config);
+    regulator.update(100, 98, false, start);
+    regulator.update(100, 98, true, start + 250ms);
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0);
+
+    // the integrator starts from zero again
+    regulator.update(100, 98, false, start + 500ms);
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0.9);
+}
+
+TEST(CurrentRegulator, StopsIntegratingWhenSaturated) {
+    CurrentRegulator regulator(config);
+    auto now = start;
+    for (int i = 0; i < 100; ++i) {
+        regulator.update(100, 95.1, false, now);
+        now += 250ms;
+        EXPECT_LE(regulator.get_trim(), config.max_trim);
+    }
+    // the integrator stopped at 3 * 1.225 A, the next step would have saturated the output
+    EXPECT_NEAR(regulator.get_trim(), 0.2 * 4.9 + 3 * 1.225, 1e-4);
+
+    // without windup the trim follows an overshoot at once
+    regulator.update(100, 101, false, now);
+    EXPECT_NEAR(regulator.get_trim(), -0.2 + 3 * 1.225 - 0.25, 1e-4);
+}
+
+TEST(CurrentRegulator, LimitsTheTimeStepOfALateUpdate) {
+    CurrentRegulator regulator(config);
+    regulator.update(100, 99, false, start);
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0.2 + 0.25);
+
+    // 10 s later the integrator moves by two periods only
+    regulator.update(100, 99, false, start + 10s);
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0.2 + 0.25 + 0.5);
+}
+
+TEST(CurrentRegulator, ResetClearsTheTrim) {
+    CurrentRegulator regulator(config);
+    regulator.update(100, 98, false, start);
+    regulator.reset();
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0);
+    EXPECT_FLOAT_EQ(regulator.get_error(), 0);
+
+    // the next measurement is taken right away
+    regulator.update(100, 98, false, start + 1ms);
+    EXPECT_FLOAT_EQ(regulator.get_trim(), 0.9);
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "cycle_scheduler.hpp"
+
+using namespace std::chrono_literals;
+
+TEST(CycleScheduler, ReleasesOnAbsoluteDeadlines) {
+    CycleScheduler scheduler(100ms, 0.5);
+    scheduler.begin_cycle();
+    const auto first_release = scheduler.next_release();
+    scheduler.end_cycle();
+    EXPECT_EQ(scheduler.next_release(), first_release + 100ms);
+
+    // a late start does not move the following releases
+    std::this_thread::sleep_until(scheduler.next_release() + 5ms);
+    scheduler.begin_cycle();
+    scheduler.end_cycle();
+    EXPECT_EQ(scheduler.next_release(), first_release + 200ms);
+
+    const auto statistics = scheduler.get_statistics();
+    EXPECT_EQ(statistics.period, 100ms);
+    EXPECT_EQ(statistics.cycles, 2u);
+    EXPECT_EQ(statistics.overruns, 0u);
+    EXPECT_EQ(statistics.missed_releases, 0u);
+    EXPECT_GE(statistics.jitter_max, 5ms);
+    EXPECT_GE(statistics.interval_max, 100ms);
+}
+
+TEST(CycleScheduler, SkipsTheReleasesAnOverrunMissed) {
+    CycleScheduler scheduler(10ms, 0.5);
+    scheduler.begin_cycle();
+    const auto first_release = scheduler.next_release();
+    std::this_thread::sleep_for(25ms);
+    scheduler.end_cycle();
+    const auto now = CycleScheduler::Clock::now();
+
+    const auto statistics = scheduler.get_statistics();
+    EXPECT_EQ(statistics.overruns, 1u);
+    // the releases at 10 ms and 20 ms at least
+    EXPECT_GE(statistics.missed_releases, 2u);
+    EXPECT_GE(statistics.duration_max, 25ms);
+
+    // the next release is the first one in the future, on the grid of the period
+    const auto next_release = scheduler.next_release();
+    EXPECT_EQ(next_release, first_release + (statistics.missed_releases + 1) * 10ms);
+    EXPECT_GT(next_release, now - 1ms);
+    EXPECT_LE(next_release, now + 10ms);
+}
+
+TEST(CycleScheduler, CountsLowPriorityWorkPastTheBudget) {
+    CycleScheduler scheduler(40ms, 0.25);
+    scheduler.begin_cycle();
+    EXPECT_TRUE(scheduler.low_priority_budget_left());
+    std::this_thread::sleep_for(15ms);
+    EXPECT_FALSE(scheduler.low_priority_budget_left());
+    scheduler.count_skipped_work();
+    scheduler.end_cycle();
+
+    EXPECT_EQ(scheduler.get_statistics().skipped_work, 2u);
+}
+
+TEST(CycleScheduler, LimitsThePeriod) {
+    CycleScheduler scheduler(0ms, 0.5);
+    EXPECT_EQ(scheduler.get_statistics().period, 1ms);
+}
@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "lock_free.hpp"
+
+namespace {
+
+struct Node {
+    int value{0};
+    std::atomic<Node*> next_node{nullptr};
+};
+
+} // namespace
+
+TEST(SpscRing, PopsInOrderAndRefusesWhenFullOrEmpty) {
+    SpscRing<int, 4> ring;
+    int value = 0;
+    EXPECT_FALSE(ring.pop(value));
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(ring.push(i));
+    }
+    EXPECT_FALSE(ring.push(4));
+
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(ring.pop(value));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_FALSE(ring.pop(value));
+}
+
+TEST(SpscRing, WrapsAround) {
+    SpscRing<int, 4> ring;
+    int value = 0;
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(ring.push(i));
+        ASSERT_TRUE(ring.push(i + 100));
+        ASSERT_TRUE(ring.pop(value));
+        EXPECT_EQ(value, i);
+        ASSERT_TRUE(ring.pop(value));
+        EXPECT_EQ(value, i + 100);
+    }
+}
+
+TEST(SpscRing, HandsOverEveryValueBetweenThreads) {
+    constexpr int COUNT = 100000;
+    SpscRing<int, 64> ring;
+
+    std::thread producer([&ring] {
+        for (int i = 0; i < COUNT; ++i) {
+            while (not ring.push(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    int expected = 0;
+    int value = 0;
+    while (expected < COUNT) {
+        if (ring.pop(value)) {
+            ASSERT_EQ(value, expected);
+            ++expected;
+        }
+    }
+    producer.join();
+    EXPECT_FALSE(ring.pop(value));
+}
+
+TEST(MpscQueue, PopsInOrderAndReusesNodes) {
+    MpscQueue<Node> queue;
+    EXPECT_EQ(queue.pop(), nullptr);
+
+    std::vector<Node> nodes(3);
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 3; ++i) {
+            nodes[i].value = round * 10 + i;
+            queue.push(&nodes[i]);
+        }
+        for (int i = 0; i < 3; ++i) {
+            const auto node = queue.pop();
+            ASSERT_NE(node, nullptr);
+            EXPECT_EQ(node->value, round * 10 + i);
+        }
+        EXPECT_EQ(queue.pop(), nullptr);
+    }
+}
+
+TEST(MpscQueue, DeliversEveryNodeOfConcurrentProducersOnce) {
+    constexpr int PRODUCERS = 4;
+    constexpr int COUNT = 20000;
+    MpscQueue<Node> queue;
+    std::vector<Node> nodes(PRODUCERS * COUNT);
+
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < PRODUCERS; ++producer) {
+        producers.emplace_back([&queue, &nodes, producer] {
+            for (int i = 0; i < COUNT; ++i) {
+                auto& node = nodes[producer * COUNT + i];
+                node.value = producer * COUNT + i;
+                queue.push(&node);
+            }
+        });
+    }
+
+    // a push that is half done shows as an empty queue for a moment, keep polling until all arrived
+    std::vector<int> last_of_producer(PRODUCERS, -1);
+    std::vector<bool> seen(nodes.size(), false);
+    int received = 0;
+    while (received < PRODUCERS * COUNT) {
+        const auto node = queue.pop();
+        if (node == nullptr) {
+            continue;
+        }
+        ASSERT_FALSE(seen[node->value]);
+        seen[node->value] = true;
+        // the nodes of one producer keep their order
+        const int producer = node->value / COUNT;
+        EXPECT_GT(node->value, last_of_producer[producer]);
+        last_of_producer[producer] = node->value;
+        ++received;
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    EXPECT_EQ(queue.pop(), nullptr);
+}
@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include "module_stager.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// 15 kW modules, best at 9 kW, no change while a module delivers between 7.65 kW and 10.35 kW
+const ModuleStager::Config config{15000, 0.6, 0.15, 75, 5000ms};
+const auto start = ModuleStager::Clock::time_point{} + 1h;
+
+std::vector<ModuleStager::Candidate> candidates(std::initializer_list<uint8_t> temperatures) {
+    std::vector<ModuleStager::Candidate> result;
+    uint8_t module_address = 0;
+    for (const auto temperature : temperatures) {
+        result.push_back({module_address++, temperature});
+    }
+    return result;
+}
+
+using Modules = std::vector<uint8_t>;
+
+} // namespace
+
+TEST(ModuleStager, RunsNoModuleWithoutDemand) {
+    ModuleStager stager(config);
+    EXPECT_TRUE(stager.update(false, 20000, candidates({30, 30}), start).empty());
+    EXPECT_TRUE(stager.update(true, 20000, {}, start).empty());
+    EXPECT_EQ(stager.get_stage_changes(), 0u);
+
+    stager.update(true, 20000, candidates({30, 30}), start);
+    EXPECT_TRUE(stager.update(false, 20000, candidates({30, 30}), start + 1s).empty());
+    EXPECT_EQ(stager.get_stage_changes(), 2u);
+}
+
+TEST(ModuleStager, StartsTheCoolestModulesNearTheOptimalLoad) {
+    ModuleStager stager(config);
+    // 27 kW are three modules at 9 kW
+    EXPECT_EQ(stager.update(true, 27000, candidates({50, 30, 40, 35, 60}), start), (Modules{1, 2, 3}));
+    // a small demand runs one module
+    ModuleStager low(config);
+    EXPECT_EQ(low.update(true, 500, candidates({50, 30}), start), (Modules{1}));
+}
+
+TEST(ModuleStager, KeepsTheCountWithinTheHysteresisBand) {
+    ModuleStager stager(config);
+    stager.update(true, 27000, candidates({30, 30, 30, 30, 30}), start);
+    ASSERT_EQ(stager.get_active().size(), 3u);
+
+    // 10 kW and 8 kW per module, and 8 kW per module for one module less, are inside the band
+    EXPECT_EQ(stager.update(true, 30000, candidates({30, 30, 30, 30, 30}), start + 10s).size(), 3u);
+    EXPECT_EQ(stager.update(true, 16000, candidates({30, 30, 30, 30, 30}), start + 20s).size(), 3u);
+    EXPECT_EQ(stager.get_stage_changes(), 1u);
+
+    // 11 kW per module is above the band
+    EXPECT_EQ(stager.update(true, 33000, candidates({30, 30, 30, 30, 30}), start + 30s).size(), 4u);
+    // 7 kW per module for one module less is below it
+    EXPECT_EQ(stager.update(true, 14000, candidates({30, 30, 30, 30, 30}), start + 40s).size(), 2u);
+    EXPECT_EQ(stager.get_stage_changes(), 3u);
+}
+
+TEST(ModuleStager, HoldsTheCountAfterAChange) {
+    ModuleStager stager(config);
+    stager.update(true, 27000, candidates({30, 30, 30, 30, 30}), start);
+
+    // outside the band, but the last change is less than the hold time ago
+    EXPECT_EQ(stager.update(true, 33000, candidates({30, 30, 30, 30, 30}), start + 1s).size(), 3u);
+    EXPECT_EQ(stager.update(true, 10000, candidates({30, 30, 30, 30, 30}), start + 2s).size(), 3u);
+    EXPECT_EQ(stager.update(true, 10000, candidates({30, 30, 30, 30, 30}), start + 5s).size(), 1u);
+}
+
+TEST(ModuleStager, AddsModulesAtOnceWhenTheRunningOnesCannotDeliver) {
+    ModuleStager stager(config);
+    stager.update(true, 9000, candidates({30, 30, 30, 30}), start);
+    ASSERT_EQ(stager.get_active().size(), 1u);
+
+    // 40 kW need three 15 kW modules, the hold time does not apply
+    EXPECT_EQ(stager.update(true, 40000, candidates({30, 30, 30, 30}), start + 1s).size(), 3u);
+    // never more modules than answer
+    EXPECT_EQ(stager.update(true, 90000, candidates({30, 30, 30, 30}), start + 2s).size(), 4u);
+}
+
+TEST(ModuleStager, ReplacesAModuleThatStopsAnswering) {
+    ModuleStager stager(config);
+    EXPECT_EQ(stager.update(true, 18000, candidates({30, 31, 40}), start), (Modules{0, 1}));
+
+    // module 1 is gone, within the hold time module 2 takes over
+    std::vector<ModuleStager::Candidate> remaining{{0, 30}, {2, 40}};
+    EXPECT_EQ(stager.update(true, 18000, remaining, start + 1s), (Modules{0, 2}));
+}
+
+TEST(ModuleStager, PrefersRunningModulesAndRunsHotOnesLast) {
+    ModuleStager stager(config);
+    EXPECT_EQ(stager.update(true, 9000, candidates({40, 45, 80}), start), (Modules{0}));
+
+    // module 1 got cooler than the running module 0, that alone is no reason to switch
+    EXPECT_EQ(stager.update(true, 9000, candidates({40, 35, 80}), start + 10s), (Modules{0}));
+    // a running module above the temperature limit is replaced
+    EXPECT_EQ(stager.update(true, 9000, candidates({76, 35, 80}), start + 20s), (Modules{1}));
+    // the hot modules only run if there is no other one
+    EXPECT_EQ(stager.update(true, 40000, candidates({76, 35, 80}), start + 30s), (Modules{0, 1, 2}));
+}
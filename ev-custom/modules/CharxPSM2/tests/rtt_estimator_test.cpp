@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include "rtt_estimator.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+const RttEstimator::Config config{20ms, 200ms, 3.0};
+
+void add_samples(RttEstimator& estimator, std::chrono::nanoseconds rtt, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        estimator.add_sample(rtt);
+    }
+}
+
+} // namespace
+
+TEST(RttEstimator, UsesTheCeilingUntilThereAreEnoughSamples) {
+    RttEstimator estimator;
+    EXPECT_FALSE(estimator.has_estimate());
+    EXPECT_EQ(estimator.timeout(config), 200ms);
+
+    add_samples(estimator, 10ms, RttEstimator::MIN_SAMPLES - 1);
+    EXPECT_FALSE(estimator.has_estimate());
+    EXPECT_EQ(estimator.timeout(config), 200ms);
+
+    estimator.add_sample(10ms);
+    EXPECT_TRUE(estimator.has_estimate());
+    EXPECT_EQ(estimator.p99(), 10ms);
+}
+
+TEST(RttEstimator, P99IsTheHighQuantileOfTheSamples) {
+    RttEstimator estimator;
+    for (int rtt = 1; rtt <= 20; ++rtt) {
+        estimator.add_sample(std::chrono::milliseconds(rtt));
+    }
+    // ceil(0.99 * 20) = 20, the slowest of 20 samples
+    EXPECT_EQ(estimator.p99(), 20ms);
+
+    RttEstimator window;
+    add_samples(window, 1ms, 100);
+    window.add_sample(50ms);
+    EXPECT_EQ(window.p99(), 50ms);
+}
+
+TEST(RttEstimator, ForgetsSamplesOutsideTheWindow) {
+    RttEstimator estimator;
+    add_samples(estimator, 100ms, RttEstimator::WINDOW_SIZE);
+    EXPECT_EQ(estimator.p99(), 100ms);
+
+    add_samples(estimator, 5ms, RttEstimator::WINDOW_SIZE - 1);
+    EXPECT_EQ(estimator.p99(), 100ms);
+    estimator.add_sample(5ms);
+    EXPECT_EQ(estimator.p99(), 5ms);
+}
+
+TEST(RttEstimator, TimeoutIsTheScaledP99WithinFloorAndCeiling) {
+    RttEstimator estimator;
+    add_samples(estimator, 10ms, RttEstimator::MIN_SAMPLES);
+    // 3 * 10 ms, plus the millisecond the truncation may have cost
+    EXPECT_EQ(estimator.timeout(config), 31ms);
+
+    RttEstimator fast;
+    add_samples(fast, 2ms, RttEstimator::MIN_SAMPLES);
+    EXPECT_EQ(fast.timeout(config), 20ms);
+
+    RttEstimator slow;
+    add_samples(slow, 1s, RttEstimator::MIN_SAMPLES);
+    EXPECT_EQ(slow.timeout(config), 200ms);
+}
+
+TEST(RttEstimator, NegativeSamplesCountAsZero) {
+    RttEstimator estimator;
+    add_samples(estimator, -5ms, RttEstimator::MIN_SAMPLES);
+    EXPECT_EQ(estimator.p99(), 0ms);
+    EXPECT_EQ(estimator.timeout(config), 20ms);
+}
@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include "thermal_derating.hpp"
+
+namespace {
+
+const ThermalDerating::Config config{60, 80, 0.2, 0.05};
+
+} // namespace
+
+TEST(ThermalDerating, FullOutputUpToTheStartAndMinimumFromTheEnd) {
+    const ThermalDerating derating(config);
+    EXPECT_FLOAT_EQ(derating.factor(25), 1);
+    EXPECT_FLOAT_EQ(derating.factor(60), 1);
+    EXPECT_FLOAT_EQ(derating.factor(80), 0.2);
+    EXPECT_FLOAT_EQ(derating.factor(100), 0.2);
+}
+
+TEST(ThermalDerating, SmoothstepInBetween) {
+    const ThermalDerating derating(config);
+    EXPECT_FLOAT_EQ(derating.factor(70), 0.6);
+    // flat at both ends, steepest in the middle
+    EXPECT_GT(derating.factor(61), 0.99);
+    EXPECT_LT(derating.factor(79), 0.21);
+    EXPECT_GT(derating.factor(69) - derating.factor(71), derating.factor(61) - derating.factor(63));
+
+    float previous = 1;
+    for (float temperature = 60; temperature <= 80; temperature += 0.5) {
+        const float factor = derating.factor(temperature);
+        EXPECT_LE(factor, previous);
+        previous = factor;
+    }
+}
+
+TEST(ThermalDerating, ClampsTheMinimumFactor) {
+    ThermalDerating::Config clamped = config;
+    clamped.min_factor = -1;
+    EXPECT_FLOAT_EQ(ThermalDerating(clamped).factor(90), 0);
+    clamped.min_factor = 2;
+    EXPECT_FLOAT_EQ(ThermalDerating(clamped).factor(90), 1);
+}
+
+TEST(ThermalDerating, PublishesChangesAboveTheThreshold) {
+    ThermalDerating derating(config);
+    EXPECT_TRUE(derating.needs_publish(1));
+    derating.published(1);
+    EXPECT_FALSE(derating.needs_publish(1));
+
+    EXPECT_FALSE(derating.needs_publish(0.97));
+    EXPECT_TRUE(derating.needs_publish(0.9));
+    derating.published(0.9);
+    EXPECT_FALSE(derating.needs_publish(0.88));
+}
+
+TEST(ThermalDerating, AlwaysPublishesTheEndsOfTheCurve) {
+    ThermalDerating derating(config);
+    derating.published(0.98);
+    // back to full output, even though the change is below the threshold
+    EXPECT_TRUE(derating.needs_publish(1));
+
+    derating.published(0.22);
+    EXPECT_TRUE(derating.needs_publish(0.2));
+    derating.published(0.2);
+    EXPECT_FALSE(derating.needs_publish(0.2));
+}